@@ -106,11 +106,11 @@ void do_releasechild(task_t *task)
 	task->chldpid = child->id;
 	
 	_scheduler_removetask(child);
-	kernel_pages_free(archcont_getkstack(&child->ac));
+	destroy_task(child);
 	
-	pmap_free(child->vm_map->pmap);
-	kfree(child->vm_map);
-	kfree(child);
+	/* Other terminated children are released on next signal handling */
+	if (task->zombies != NULL)
+		task->sigmap |= (0x80000000 >> SIGCHLD);
 	
 	return;
 }	
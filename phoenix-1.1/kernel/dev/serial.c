@@ -77,6 +77,7 @@ void serial_isr(u32 irq)
 			if (serial->rp == serial->rb) {
 				serial->rb = (++serial->rb % RBUFFSZ);
 			}
+			wakeup_on(&serial->rp);
 		}
 			
 		/* Transmit */
@@ -82,6 +82,10 @@ void keyb_intr(uint_t intr)
 	}
 	unlock(&ttyd.mutex);
 	
+	/* Wake up task waiting for characters */
+	if (!ttyd.isempty)
+		wakeup_on((uint_t *)&ttyd.isempty);
+	
 	return;
 }
 
@@ -84,9 +84,13 @@ void archcont_init(void)
  */
 void archcont_create(archcont_t *ac, uint_t start, uint_t kstack, uint_t stack, uint_t type, pmap_t *pmap)
 {	
+	ac->kstack = (void *)kstack;
+	
 	switch (type) {	
 	case KERNEL_TASK:
-		ac->cr3 = KERNEL_PAGE_DIR;
+	
+		/* Kernel thread uses address space of the previous task (lazy CR3) */
+		ac->cr3 = 0;
 		ac->esp0 = kstack + PAGE_SIZE - ARCHCONT_SIZE - 12 - 4;	
 		
 		/* Prepare startup context for kernel thread */
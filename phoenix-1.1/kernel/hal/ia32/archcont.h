@@ -38,7 +38,7 @@
 /* Architecture dependent part of CPU context */
 typedef struct {
 	uint_t esp0;       /* top of the kernel stack */
-	uint_t cr3;        /* page directory register */
+	uint_t cr3;        /* page directory register, 0 for kernel threads */
 	void *kstack;      /* kstack starting address */
 } archcont_t;
 
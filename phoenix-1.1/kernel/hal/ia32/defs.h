@@ -34,15 +34,26 @@
 #define PAGE_TABLE_SIZE         0x0400      /* number of entries in page table */
 
 
+#define NCPUS                   1           /* number of supported processors */
+
+
+/* CPU features reported by CPUID (edx) and their CR4 enable bits */
+#define CPUID_PSE               0x00000008  /* 4 MB pages */
+#define CPUID_TSC               0x00000010  /* time stamp counter */
+#define CPUID_PGE               0x00002000  /* global pages */
+#define CR4_PSE                 0x00000010
+#define CR4_PGE                 0x00000080
+
+
 /*
  * Physical memory layout
  *
  * 0 KB   ------------------
  *              NULL
  * 4 KB   ------------------
- *              IDT
+ *            GDT, IDT
  * 8 KB   ------------------
- *              GDT
+ *        SYSPAGE (loader)
  * 12 KB  ------------------
  *             BIOS_ENV
  * 16 KB  ------------------
@@ -75,6 +86,8 @@
 
 
 #define SYSINFO_PAGE            (KERNEL_BASE + 0x7e000)
+#define SYSPAGE_ADDR            0x2000                    /* physical address of loader syspage */
+#define MAX_PHYSMEM             0x40000000                /* physical memory mapped by kernel - 1 GB */
 
 
 /* Macros used to transform physical and kernel adresses */
@@ -98,6 +111,10 @@
 #define MAX_DECIMVAL 1000000000
 
 
+/* Interrupt number passed to timer handler when it is called by reschedule() */
+#define RESCHED_INTR  0x100
+
+
 /* Used selectors */
 #define KERNEL_CS   8
 #define KERNEL_DS   16
@@ -161,7 +178,7 @@
 
 
 /* Number of syscalls */
-#define NSYSCALLS   17
+#define NSYSCALLS   24
 
 
 #endif
@@ -152,6 +152,42 @@ for (;;);
 }
 
 
+/*
+ * Page fault handler. Faults at user addresses of user tasks are resolved by
+ * allocating segment pages. Interrupts are enabled only when they were
+ * enabled in the faulting context (user stack may be touched by signal
+ * delivery in interrupt stubs).
+ */
+void pagefault_handler(u32 exc, exc_context_t *ctx)
+{
+	void *vaddr = (void *)get_cr2();
+	task_t *task;
+	uint_t attr = 0;
+	
+	task = __scheduler_getcurrent();
+	
+	if ((task == NULL) || (task->type != USER_TASK) || (vaddr >= (void *)KERNEL_BASE)) {
+		dummy_exc_handler(exc, ctx);
+		return;
+	}
+	
+	if (ctx->eflags & EFLAGS_IF)
+		sti();
+	
+	if (ctx->err & PGFLT_PRESENT)
+		attr |= VM_FAULT_PROT;
+	if (ctx->err & PGFLT_WRITE)
+		attr |= VM_FAULT_WRITE;
+	
+	if (exec_pagefault(task, vaddr, attr) == 0)
+		return;
+	
+	std_printf("\nTask %d, unallowed access to 0x%p at %p\n", task->id, vaddr, ctx->eip);
+	exit_task(-1);
+	return;
+}
+
+
 void dummy_intr_handler(uint_t intr)
 {
 	std_printf("KERNEL DEBUG interrupt [%d]\n", intr);	
@@ -268,6 +304,7 @@ void interrupts_init(void)
 	/* Set default exception and interrupt handlers */
 	for (k = 0; k < 15; k++)
 		set_exc_handler(k, (void *)&dummy_exc_handler);
+	set_exc_handler(14, (void *)&pagefault_handler);
 
 	for (k = 0; k < 15; k++)
 		set_intr_handler(k, (void *)&dummy_intr_handler);
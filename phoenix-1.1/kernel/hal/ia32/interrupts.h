@@ -56,6 +56,16 @@ typedef struct {
 #pragma pack(4)
 
 
+/* Page fault error code bits */
+#define PGFLT_PRESENT  0x01   /* fault caused by protection violation */
+#define PGFLT_WRITE    0x02   /* fault caused by write access */
+#define PGFLT_USER     0x04   /* fault in user mode */
+
+
+/* Interrupt flag in EFLAGS */
+#define EFLAGS_IF      0x200
+
+
 /* Function setups handler for specified interrupt */
 extern void set_intr_handler(uint_t intr, void *handler); 
 
@@ -65,6 +65,10 @@ static inline void memclr(void *where, uint_t n)
 		xorl	%%eax, %%eax; \
 		movl	%0, %%edi; \
 		movl  %1, %%ecx; \
+		shrl	$2, %%ecx; \
+		rep; stosl; \
+		movl	%1, %%ecx; \
+		andl	$3, %%ecx; \
 		rep; stosb"
 	:
 	: "m" (where), "d" (n)
@@ -377,6 +381,103 @@ static inline uint_t get_cr3(void)
 }
 
 
+static inline void set_cr3(uint_t cr3)
+{
+	__asm__ volatile
+	(" \
+		movl %0, %%eax; \
+		movl %%eax, %%cr3"
+	:
+	:"g" (cr3)
+	:"eax", "memory");
+	
+	return;
+}
+
+
+static inline uint_t get_cr4(void)
+{
+	uint_t cr4;
+	
+	__asm__ volatile
+	(" \
+		movl %%cr4, %%eax; \
+		movl %%eax, %0"
+	:"=g" (cr4)
+	:
+	:"eax");
+		
+	return cr4;
+}
+
+
+static inline void set_cr4(uint_t cr4)
+{
+	__asm__ volatile
+	(" \
+		movl %0, %%eax; \
+		movl %%eax, %%cr4"
+	:
+	:"g" (cr4)
+	:"eax");
+	
+	return;
+}
+
+
+/* Function returns low part of time stamp counter, CPU must support CPUID_TSC */
+static inline uint_t get_cycles(void)
+{
+	uint_t lo;
+	
+	__asm__ volatile
+	(" \
+		rdtsc"
+	:"=a" (lo)
+	:
+	:"edx");
+	
+	return lo;
+}
+
+
+/*
+ * Function returns CPU feature flags (CPUID function 1, edx register).
+ * CPUs without CPUID instruction (ID flag can't be changed) have no features.
+ */
+static inline uint_t cpu_features(void)
+{
+	uint_t id, eax, edx;
+	
+	__asm__ volatile
+	(" \
+		pushfl; \
+		pushfl; \
+		xorl $0x200000, (%%esp); \
+		popfl; \
+		pushfl; \
+		popl %0; \
+		xorl (%%esp), %0; \
+		popfl; \
+		andl $0x200000, %0"
+	:"=r" (id)
+	:
+	:"memory");
+	
+	if (!id)
+		return 0;
+	
+	__asm__ volatile
+	(" \
+		cpuid"
+	:"=a" (eax), "=d" (edx)
+	:"0" (1)
+	:"ebx", "ecx");
+	
+	return edx;
+}
+
+
 static inline void set_pc(void *pc)
 {
 	 __asm__ volatile (" jmpl *%0" ::"m" (pc));
@@ -421,6 +522,60 @@ static inline void bus_outb(uint_t addr, uchar_t b)
 #define unlock_sti(m) { unlock(m); sti(); }
 
 
+/* Function disables interrupts and returns previous EFLAGS value */
+static inline uint_t cli_save(void)
+{
+	uint_t eflags;
+	
+	__asm__ volatile
+	(" \
+		pushfl; \
+		popl %0; \
+		cli"
+	:"=r" (eflags)
+	:
+	:"memory");
+	
+	return eflags;
+}
+
+
+/* Function restores EFLAGS (and interrupt flag) saved by cli_save() */
+static inline void restore_flags(uint_t eflags)
+{
+	__asm__ volatile
+	(" \
+		pushl %0; \
+		popfl"
+	:
+	:"r" (eflags)
+	:"memory", "cc");
+}
+
+
+/* Function returns index of the least significant bit set in nonzero v */
+static inline uint_t first_bit(uint_t v)
+{
+	uint_t idx;
+	
+	__asm__ volatile
+	(" \
+		bsfl %1, %0"
+	:"=r" (idx)
+	:"rm" (v)
+	:"cc");
+	
+	return idx;
+}
+
+
+/* Function returns number of current processor */
+static inline uint_t cpu_id(void)
+{
+	return 0;
+}
+
+
 /*
  * Functions operating on segment descriptors and GDT table
  */
@@ -465,6 +620,9 @@ static inline ushort_t insert_gdtdesc(uint_t n, uint_t base, uint_t limit, uint_
  * to kernel, it stores all CPU registers on kernel stack, saves its stack
  * pointer in the architecture dependent part of task structure, reloads page
  * directory and switches stack to kernel stack of new scheduled task.
+ * Page directory isn't reloaded when it is already loaded or when new task
+ * is kernel thread (cr3 is 0) - kernel threads run in the address space of
+ * the previous task, so the TLB isn't flushed.
  */
 
 
@@ -493,7 +651,13 @@ static inline void switch_to(task_t *old, task_t *new)
 	(" \
 		movl %0, %%ebx; \
 		movl 4(%%ebx), %%eax; \
+		testl %%eax, %%eax; \
+		jz 1f; \
+		movl %%cr3, %%ecx; \
+		cmpl %%eax, %%ecx; \
+		je 1f; \
 		movl %%eax, %%cr3; \
+	1: \
 		movl (%%ebx), %%esp; \
 		movl %%esp, %%eax; \
 		addl $0x1000, %%eax; \
@@ -514,7 +678,7 @@ static inline void switch_to(task_t *old, task_t *new)
 		iret"
 	:
 	: "m" (p1), "g" (&common_tss)
-	: "eax", "ebx");
+	: "eax", "ebx", "ecx");
 	return;	
 }
 
@@ -540,7 +704,13 @@ static inline void switch_context(task_t *old, task_t *new)
 	(" \
 		movl %0, %%ebx; \
 		movl 4(%%ebx), %%eax; \
+		testl %%eax, %%eax; \
+		jz 1f; \
+		movl %%cr3, %%ecx; \
+		cmpl %%eax, %%ecx; \
+		je 1f; \
 		movl %%eax, %%cr3; \
+	1: \
 		movl (%%ebx), %%esp; \
 		movl %%esp, %%eax; \
 		addl $0x1000, %%eax; \
@@ -549,12 +719,12 @@ static inline void switch_context(task_t *old, task_t *new)
 		movl %%eax, 4(%%ebx)"
 	:
 	: "m" (p1), "g" (&common_tss)
-	: "eax", "ebx");
+	: "eax", "ebx", "ecx");
 	return;	
 }
 
 
-extern void (*_irq0)(uint_t intr);
+extern void (*_resched)(uint_t intr);
 
 
 static inline void reschedule(void)
@@ -568,7 +738,7 @@ static inline void reschedule(void)
 			pushl %%eax; \
 			call %0"
 		:
-		: "m" (_irq0));
+		: "m" (_resched));
 	
 	return;	
 }
@@ -589,6 +759,18 @@ static inline void settr(uint_t sel)
 }
 
 
+/* Function invalidates TLB entry of page containing vaddr */
+static inline void invlpg(void *vaddr)
+{
+	__asm__ volatile
+	(" \
+		invlpg (%0)"
+	:
+	: "r" (vaddr)
+	: "memory");
+}
+
+
 #define __flush_tlb() \
 do { unsigned long tmpreg; __asm__ __volatile__("movl %%cr3,%0\n\tmovl %0,%%cr3":"=r" (tmpreg) : :"memory"); } while (0)
 
@@ -596,6 +778,10 @@ do { unsigned long tmpreg; __asm__ __volatile__("movl %%cr3,%0\n\tmovl %0,%%cr3"
 #define __hlt()  { __asm__ __volatile__ ("hlt"::); }
 
 
+/* Macro enables interrupts and halts, interrupt can't be delivered before hlt */
+#define __sti_hlt()  { __asm__ __volatile__ ("sti; hlt"::); }
+
+
 /* Macro sends acknowledge to interrupt controler */
 #define __intr_end(intr) {                                           \
 	if (intr < 8)	bus_outb(0x20, 0x60 | intr);                         \
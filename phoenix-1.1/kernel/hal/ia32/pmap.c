@@ -27,10 +27,12 @@
 #include <hal/current/defs.h>
 #include <hal/current/types.h>
 #include <hal/current/pmap.h>
+#include <hal/current/sysinfo.h>
 
 #include <init/std.h>
 #include <vm/vm.h>
 #include <vm/kmalloc.h>
+#include <vm/cache.h>
 
 
 /* Top of statically allocated kernel physical memory */
@@ -44,6 +46,22 @@ uint_t kernel_mem_top = KERNEL_BSS_END;
 uint_t needed_entries;
 
 
+/* Paging features enabled by pmap_init() */
+uint_t pmap_features = 0;
+
+
+/* Physical memory ranges built by pmap_init() */
+#define PMAP_MAXRANGES  (3 * SYSPAGE_MAXMM + 8)
+
+pmap_range_t pmap_ranges[PMAP_MAXRANGES];
+uint_t pmap_nranges = 0;
+
+
+/* Caches of pmap structures and constructed page directories */
+cache_t *pmap_cache;
+cache_t *pdir_cache;
+
+
 /* Function initializes page directory */
 static inline void pmap_initpdir(uint_t *pdir)
 {
@@ -87,18 +105,196 @@ void *pmap_maptable(pdentry_t *pdir, ptentry_t *ptable, void *minaddr, uint_t fl
 }		
 
 
+/* Function returns syspage when it contains BIOS memory map prepared by loader */
+static syspage_t *pmap_syspage(void)
+{
+	syspage_t *syspage = (syspage_t *)PHYS_TO_KERNEL(SYSPAGE_ADDR);
+	
+	if ((syspage->mmsize == 0) || (syspage->mmsize > SYSPAGE_MAXMM))
+		return NULL;
+	return syspage;
+}
+
+
+/* Function returns first and next to the last whole page of memory map entry */
+static inline void pmap_mmpages(syspage_mmitem_t *mm, uint_t *start, uint_t *end)
+{
+	*start = (mm->addr / PAGE_SIZE) + ((mm->addr & (PAGE_SIZE - 1)) != 0);
+	
+	/* Entries crossing 4 GB end at the last page below it */
+	if (mm->len_hi || (mm->addr + mm->len < mm->addr))
+		*end = 0xfffff;
+	else
+		*end = (mm->addr + mm->len) / PAGE_SIZE;
+	return;
+}
+
+
+/*
+ * Function returns physical memory size. It is taken from the BIOS memory map
+ * passed by loader in syspage, probed size is used when the map is missing.
+ */
+uint_t pmap_getmemsize(uint_t probed)
+{
+	syspage_t *syspage;
+	uint_t k, start, end, npages = 0;
+	
+	if ((syspage = pmap_syspage()) == NULL)
+		return probed;
+	
+	for (k = 0; k < syspage->mmsize; k++) {
+		if ((syspage->mm[k].type != SYSPAGE_MMFREE) || syspage->mm[k].addr_hi)
+			continue;
+		pmap_mmpages(&syspage->mm[k], &start, &end);
+		if (end > npages)
+			npages = end;
+	}
+	
+	if (npages > MAX_PHYSMEM / PAGE_SIZE)
+		npages = MAX_PHYSMEM / PAGE_SIZE;
+	
+	return npages ? npages * PAGE_SIZE : probed;
+}
+
+
+/* Function appends range of pages to the physical memory map, present pages below 16 MB are DMA capable */
+static void pmap_addrange(uint_t start, uint_t end, uint_t flags)
+{
+	pmap_range_t *last;
+	
+	if (start >= end)
+		return;
+	
+	if ((flags & PG_PRESENT) && (start < 0x1000000 / PAGE_SIZE)) {
+		if (end > 0x1000000 / PAGE_SIZE) {
+			pmap_addrange(start, 0x1000000 / PAGE_SIZE, flags);
+			pmap_addrange(0x1000000 / PAGE_SIZE, end, flags);
+			return;
+		}
+		flags |= PG_DMA;
+	}
+	
+	/* Range adjacent to the last one with the same attributes extends it */
+	if (pmap_nranges) {
+		last = &pmap_ranges[pmap_nranges - 1];
+		if ((last->end == start) && (last->flags == flags)) {
+			last->end = end;
+			return;
+		}
+	}
+	
+	if (pmap_nranges == PMAP_MAXRANGES)
+		return;
+	
+	pmap_ranges[pmap_nranges].start = start;
+	pmap_ranges[pmap_nranges].end = end;
+	pmap_ranges[pmap_nranges].flags = flags;
+	pmap_nranges++;
+	return;
+}
+
+
+/*
+ * Function builds physical memory map of size bytes. Memory up to the end of
+ * statically allocated kernel memory and page descriptors is reserved. Above
+ * it pages covered by usable entries of BIOS memory map are present, gaps
+ * between them are reserved holes.
+ */
+static void pmap_mkranges(uint_t size)
+{
+	syspage_t *syspage;
+	uint_t npages = size / PAGE_SIZE, top, start, end, next, s, e, k;
+	
+	top = (kernel_mem_top + npages * sizeof(page_t)) / PAGE_SIZE + 1;
+	pmap_nranges = 0;
+	
+	/* NULL page, loader structures and kernel, ROM BIOS and device memory, kernel memory */
+	pmap_addrange(0, 0xa0000 / PAGE_SIZE, PG_RSVD | PG_KERNEL);
+	pmap_addrange(0xa0000 / PAGE_SIZE, 0x100000 / PAGE_SIZE + 1, PG_RSVD);
+	pmap_addrange(0x100000 / PAGE_SIZE + 1, top, PG_RSVD | PG_KERNEL);
+	
+	if ((syspage = pmap_syspage()) == NULL) {
+		pmap_addrange(top, npages, PG_PRESENT);
+		return;
+	}
+	
+	for (start = top; start < npages; start = end) {
+		
+		/* Find usable entries containing start and the nearest one above it */
+		end = start;
+		next = npages;
+		for (k = 0; k < syspage->mmsize; k++) {
+			if ((syspage->mm[k].type != SYSPAGE_MMFREE) || syspage->mm[k].addr_hi)
+				continue;
+			pmap_mmpages(&syspage->mm[k], &s, &e);
+			
+			if ((s <= start) && (e > end))
+				end = e;
+			else if ((s > start) && (s < next))
+				next = s;
+		}
+		
+		if (end > start) {
+			if (end > npages)
+				end = npages;
+			pmap_addrange(start, end, PG_PRESENT);
+		}
+		else {
+			end = next;
+			pmap_addrange(start, end, PG_RSVD);
+		}
+	}
+	return;
+}
+
+
+/*
+ * Function returns n-th range of physical memory. Ranges are sorted and
+ * cover all pages of memory given to pmap_init().
+ */
+int pmap_getrange(uint_t n, pmap_range_t *range)
+{
+	if (n >= pmap_nranges)
+		return -1;
+	
+	range->start = pmap_ranges[n].start;
+	range->end = pmap_ranges[n].end;
+	range->flags = pmap_ranges[n].flags;
+	return 0;
+}
+
+
 /*
  * Function initializes machine dependent pmap interface. In initialization
  * procedure next kernel page tables are created (neccesary to map all physical memory
  * in kernel space). Top of the staticaly allocated kernel memory is increased.
  * num_of_ptable = 1 GB / 4 MB = 256
  * kernel_mem_top += size / PAGE_DIR_SIZE / PAGE_SIZE 
+ * When CPU supports PSE, memory above first 4 MB is mapped with 4 MB pages
+ * and no page tables are allocated. When CPU supports PGE, kernel mappings
+ * are global. Finally physical memory map is built.
  */
 void pmap_init(uint_t size)
 {
 	uint_t needed_size;
 	ptentry_t *ptables, *addr;
-	uint_t k;
+	pdentry_t *pdir = (pdentry_t *)PHYS_TO_KERNEL(KERNEL_PAGE_DIR);
+	ptentry_t *ptable0 = (ptentry_t *)PHYS_TO_KERNEL(KERNEL_PAGE_TABLE);
+	uint_t k, features, global = 0;
+	
+	features = cpu_features();
+	
+	/*
+	 * Kernel mappings are the same in all address spaces, so they can be
+	 * global. Identity mapping of the first 4 MB used during boot shares
+	 * the static page table and has to be removed before.
+	 */
+	if (features & CPUID_PGE) {
+		*(pdir + 0) = ((*(pdir + 0)) & 0xfffffffe);
+		for (k = 0; k < PAGE_TABLE_SIZE; k++)
+			*(ptable0 + k) |= PGHD_GLOBAL;
+		global = PGHD_GLOBAL;
+	}
 	
 	needed_size = size / PAGE_DIR_SIZE;
 	
@@ -106,68 +302,84 @@ void pmap_init(uint_t size)
 	if (needed_size > PAGE_TABLE_SIZE * sizeof(ptentry_t))
 		needed_size -= PAGE_TABLE_SIZE * sizeof(ptentry_t);
 	
-	ptables = (ptentry_t *)PHYS_TO_KERNEL(kernel_mem_top);
-	
-	/* Static kernel memory allocation */
-	kernel_mem_top += needed_size;
 	needed_entries = needed_size / PAGE_SIZE;
 	
-	/* Initialize and map kernel page tables */
-	for (k = 0; k < needed_entries; k++) {
-		pmap_initptable(ptables + k * PAGE_TABLE_SIZE, (k + 1) * 0x00400000,
-		                PGHD_PRESENT | PGHD_SYSTEM | PGHD_WRITE);		
-		addr = pmap_maptable((pdentry_t *)PHYS_TO_KERNEL(KERNEL_PAGE_DIR), ptables + k * PAGE_TABLE_SIZE,
-		                     (void *)KERNEL_BASE + (k + 1) * 0x400000,
-		                     PTHD_PRESENT | PTHD_SYSTEM | PTHD_WRITE);
-		                     
+	/* Map kernel linear region with 4 MB pages, first 4 MB are still mapped by static page table */
+	if (features & CPUID_PSE) {
+		set_cr4(get_cr4() | CR4_PSE);
+		pmap_features |= PMAP_PSE;
+		
+		for (k = 0; k < needed_entries; k++) {
+			*(pdir + 0) = ((*(pdir + 0)) & 0xfffffffe);
+			*(pdir + GET_PDIR_IDX(KERNEL_BASE) + k + 1) = ((k + 1) * 0x00400000) |
+			                                              PTHD_PRESENT | PTHD_SYSTEM | PTHD_WRITE | PTHD_LARGE | global;
+		}
+	}
+	else {
+		ptables = (ptentry_t *)PHYS_TO_KERNEL(kernel_mem_top);
+		
+		/* Static kernel memory allocation */
+		kernel_mem_top += needed_size;
+		
+		/* Initialize and map kernel page tables */
+		for (k = 0; k < needed_entries; k++) {
+			pmap_initptable(ptables + k * PAGE_TABLE_SIZE, (k + 1) * 0x00400000,
+			                PGHD_PRESENT | PGHD_SYSTEM | PGHD_WRITE | global);		
+			addr = pmap_maptable(pdir, ptables + k * PAGE_TABLE_SIZE,
+			                     (void *)KERNEL_BASE + (k + 1) * 0x400000,
+			                     PTHD_PRESENT | PTHD_SYSTEM | PTHD_WRITE);
+			                     
 #ifdef _DEBUG_PMAP
-		printf("mapped: [%x] %d MB\n", addr, (uint_t)addr / 1024 / 1024);	
+			printf("mapped: [%x] %d MB\n", addr, (uint_t)addr / 1024 / 1024);	
 #endif
+		}
+	}
+	__flush_tlb();
+	
+	/* Global bits are honoured from now, all TLB entries left are kernel ones */
+	if (features & CPUID_PGE) {
+		set_cr4(get_cr4() | CR4_PGE);
+		pmap_features |= PMAP_PGE;
 	}
-	__flush_tlb();	
+	
+	pmap_mkranges(size);
+	return;
 }	
 
 
-/* Function fills page_t structure for page frame given by pn */
-page_t *pmap_getphyspage(uint_t size, page_t *page, uint_t pn)
+/* Function returns top of statically allocated kernel memory */
+uint_t pmap_get_kmem_top(void)
 {
-	uint_t map_size = size / PAGE_SIZE * sizeof(page_t);
-	uint_t paddr = pn * PAGE_SIZE;
-	
-	page->flags = 0;
-	page->next = NULL;
-	page->prev = NULL;
-	page->num = pn;
-	
-	/* 0 - 4 KB - range - page isn't present for NULL pointer exception */
-	if ((paddr >= 0) && (paddr <= PAGE_SIZE))
-		page->flags = PG_RSVD | PG_KERNEL;
-		
-	/* 640KB - 1MB - ROM BIOS and device memory space */
-	else if ((paddr >= 0xa0000) && (paddr <= 0x100000))
-		page->flags = PG_RSVD;
+	return kernel_mem_top;
+}
 
-	/*  kernel reserved physical memory */
-	else if ((paddr >= KERNEL_CODE_START) && (paddr <= kernel_mem_top + map_size))
-		page->flags = PG_RSVD | PG_KERNEL;
-	
-	else {
-	
-		/* physcial memory for DMA < 16 MB */
-		if (paddr < 0x1000000) {
-			page->flags = PG_DMA;
-		}
-		
-		page->flags |= PG_PRESENT;
-	}
-	return page;
+
+/*
+ * Page directory constructor. User part of directory is cleared and kernel
+ * page tables (the static one and those created by pmap_init()) or 4 MB
+ * pages are mapped.
+ * Released directories are returned to the cache with user part cleared.
+ */
+static void pmap_pdirctor(void *pdir)
+{
+	memclr(pdir, PAGE_SIZE);
+	memcpy(pdir + (KERNEL_BASE / PAGE_DIR_SIZE / PAGE_SIZE) * 4,
+	       PHYS_TO_KERNEL(KERNEL_PAGE_DIR) + (KERNEL_BASE / PAGE_DIR_SIZE / PAGE_SIZE) * 4,
+	       (needed_entries + 1) * 4);
+	return;
 }
 
 
-/* Function returns top of statically allocated kernel memory */
-uint_t pmap_get_kmem_top(void)
+/* Function initializes caches of pmap structures and page directories */
+int pmap_initcaches(void)
 {
-	return kernel_mem_top;
+	if ((pmap_cache = cache_create(sizeof(pmap_t), 32, NULL, NULL)) == NULL)
+		return -1;
+	
+	if ((pdir_cache = cache_create(PAGE_SIZE, 16, pmap_pdirctor, NULL)) == NULL)
+		return -1;
+	
+	return 0;
 }
 
 
@@ -176,49 +388,169 @@ pmap_t *pmap_create(void)
 {
 	pmap_t *pmap;
 	
-	if ((pmap = (pmap_t *)kmalloc(sizeof(pmap_t))) == NULL)
+	if ((pmap = (pmap_t *)cache_alloc(pmap_cache)) == NULL)
 		return NULL;
 	pmap->npages = 0;
+	pmap->ntables = 0;
 	
-	if ((pmap->pdir = kernel_pages_alloc(1)) == NULL)
-		return NULL;	
-	memclr(pmap->pdir, PAGE_SIZE);
-	
-	/* Map kernel page dirs */
-	memcpy(pmap->pdir + (KERNEL_BASE / PAGE_DIR_SIZE / PAGE_SIZE) * 4,
-	       PHYS_TO_KERNEL(KERNEL_PAGE_DIR) + (KERNEL_BASE / PAGE_DIR_SIZE / PAGE_SIZE) * 4,
-	       needed_entries * 4);
+	/* Page directory from the cache has kernel page tables already mapped */
+	if ((pmap->pdir = cache_alloc(pdir_cache)) == NULL) {
+		cache_free(pmap_cache, pmap);
+		return NULL;
+	}
 
 	return pmap;
 }
 
 
+/*
+ * Function returns page table mapped by page directory entry pd_idx. When
+ * alloc is set missing page table is allocated.
+ */
+static ptentry_t *pmap_getptable(pmap_t *pmap, uint_t pd_idx, int alloc)
+{
+	pdentry_t *pde = (pdentry_t *)pmap->pdir + pd_idx;
+	page_t *page;
+	void *ptable;
+	
+	if (*pde != 0)
+		return (ptentry_t *)PHYS_TO_KERNEL((*pde & 0xfffff000));
+	
+	if (!alloc || ((page = area_alloc(1, KERNEL_MEM | AREA_ZERO)) == NULL))
+		return NULL;
+	
+	ptable = (void *)(KERNEL_BASE + page->num * PAGE_SIZE);
+	page->refs = 0;
+	*pde = ((uint_t)KERNEL_TO_PHYS(ptable) & 0xfffff000) | PTHD_PRESENT | PTHD_WRITE | PTHD_READ | PTHD_USER;
+	pmap->ntables++;
+	return ptable;
+}
+
+
 /* Functions maps page at specified address */
 int pmap_map(pmap_t *pmap, page_t *page, void *addr, uint_t flags)
 {
-	uint_t pd_idx;
+	ptentry_t *ptable;
 	uint_t pt_idx;
-	void *ptable;
 	
-	pd_idx = (uint_t)addr >> 22;
 	pt_idx = (((uint_t)addr >> 12) & 0x000003ff);
 	
 	/* If no page table is allocated add new one */
-	if (*((uint_t *)pmap->pdir + pd_idx) == 0) {
-		if ((ptable = kernel_pages_alloc(1)) == NULL)
-			return -1;
-		*((uint_t *)pmap->pdir + pd_idx) = ((uint_t)KERNEL_TO_PHYS(ptable) & 0xfffff000)
-		                                   | PTHD_PRESENT | PTHD_WRITE | PTHD_READ | PTHD_USER;
-		memclr(ptable, PAGE_SIZE);
+	if ((ptable = pmap_getptable(pmap, (uint_t)addr >> 22, 1)) == NULL)
+		return -1;
+	
+	/* Now map page, replaced mapping may be cached in TLB */
+	if (*(ptable + pt_idx) & PGHD_PRESENT) {
+		*(ptable + pt_idx) = ((page->num * PAGE_SIZE) & 0xfffff000) | flags;
+		invlpg(addr);
 	}
 	else {
-		ptable = (void *)(*((uint_t *)pmap->pdir + pd_idx) & 0xfffff000);
-		ptable = PHYS_TO_KERNEL(ptable);
+		*(ptable + pt_idx) = ((page->num * PAGE_SIZE) & 0xfffff000) | flags;
+		kernel_page(ptable)->refs++;
+		pmap->npages++;
 	}
 	
-	/* Now map page */
-	*((uint_t *)ptable + pt_idx) = ((page->num * PAGE_SIZE) & 0xfffff000) | flags;
+	return 0;
+}
+
+
+/*
+ * Function maps page list at consecutive addresses starting from vaddr.
+ * Each page table is looked up once per 4 MB span.
+ */
+int pmap_map_range(pmap_t *pmap, page_t *pages, void *vaddr, uint_t flags)
+{
+	ptentry_t *ptable;
+	page_t *ptpage, *p = pages;
+	uint_t pt_idx;
 	
+	while (p != NULL) {
+		if ((ptable = pmap_getptable(pmap, (uint_t)vaddr >> 22, 1)) == NULL)
+			return -1;
+		ptpage = kernel_page(ptable);
+		
+		/* Fill page table up to the end of its span */
+		for (pt_idx = ((uint_t)vaddr >> 12) & 0x000003ff; (p != NULL) && (pt_idx < PAGE_TABLE_SIZE);
+		     pt_idx++, p = p->next, vaddr += PAGE_SIZE) {
+			if (*(ptable + pt_idx) & PGHD_PRESENT) {
+				*(ptable + pt_idx) = ((p->num * PAGE_SIZE) & 0xfffff000) | flags;
+				invlpg(vaddr);
+			}
+			else {
+				*(ptable + pt_idx) = ((p->num * PAGE_SIZE) & 0xfffff000) | flags;
+				ptpage->refs++;
+				pmap->npages++;
+			}
+		}
+	}
+	return 0;
+}
+
+
+/*
+ * Function unmaps size bytes starting from vaddr. Only removed entries are
+ * flushed from TLB, page tables which become empty are released.
+ */
+void pmap_unmap_range(pmap_t *pmap, void *vaddr, uint_t size)
+{
+	ptentry_t *ptable;
+	page_t *ptpage;
+	void *end = vaddr + size;
+	uint_t pd_idx, pt_idx;
+	int loaded;
+	
+	/* Address space which isn't loaded has no TLB entries */
+	loaded = (get_cr3() == (uint_t)KERNEL_TO_PHYS(pmap->pdir));
+	
+	while (vaddr < end) {
+		pd_idx = (uint_t)vaddr >> 22;
+		pt_idx = ((uint_t)vaddr >> 12) & 0x000003ff;
+		
+		/* Span without page table has nothing to unmap */
+		if ((ptable = pmap_getptable(pmap, pd_idx, 0)) == NULL) {
+			vaddr += (PAGE_TABLE_SIZE - pt_idx) * PAGE_SIZE;
+			continue;
+		}
+		ptpage = kernel_page(ptable);
+		
+		for (; (vaddr < end) && (pt_idx < PAGE_TABLE_SIZE); pt_idx++, vaddr += PAGE_SIZE) {
+			if (!(*(ptable + pt_idx) & PGHD_PRESENT))
+				continue;
+			
+			*(ptable + pt_idx) = 0;
+			if (loaded)
+				invlpg(vaddr);
+			ptpage->refs--;
+			pmap->npages--;
+		}
+		
+		/* Release empty page table, its directory entry may be cached too */
+		if (!ptpage->refs) {
+			*((pdentry_t *)pmap->pdir + pd_idx) = 0;
+			if (loaded)
+				invlpg((void *)(pd_idx << 22));
+			kernel_pages_free(ptable);
+			pmap->ntables--;
+		}
+	}
+	return;
+}
+
+
+/* Function returns number of physical page mapped at vaddr */
+int pmap_getpn(pmap_t *pmap, void *vaddr, uint_t *pn)
+{
+	uint_t pde, pte;
+	
+	pde = *((uint_t *)pmap->pdir + ((uint_t)vaddr >> 22));
+	if (!(pde & PTHD_PRESENT))
+		return -1;
+	
+	pte = *((uint_t *)PHYS_TO_KERNEL((pde & 0xfffff000)) + (((uint_t)vaddr >> 12) & 0x000003ff));
+	if (!(pte & PGHD_PRESENT))
+		return -1;
+	
+	*pn = pte >> 12;
 	return 0;
 }
 
@@ -231,7 +563,12 @@ void pmap_free(pmap_t *pmap)
 	
 	if (pmap == NULL) return;
 	
-	for (k = 0; k < PAGE_DIR_SIZE; k++) {
+	/* Directory may be still loaded by kernel thread which was run after its task */
+	if (get_cr3() == (uint_t)KERNEL_TO_PHYS(pmap->pdir))
+		set_cr3(KERNEL_PAGE_DIR);
+	
+	/* Page tables are usually released by pmap_unmap_range() already */
+	for (k = 0; (k < PAGE_DIR_SIZE) && pmap->ntables; k++) {
 		ptable = (*(uint_t *)((uint_t *)pmap->pdir + k)) & 0xfffff000;
 		
 		/* Free page tables allocated by task. Don't free kernel page dirs and the NULL page. */
@@ -239,11 +576,14 @@ void pmap_free(pmap_t *pmap)
 #ifdef _DEBUG_PMAP
 			printf("free entry: %d\n", k);
 #endif
+			kernel_page(PHYS_TO_KERNEL(ptable))->refs = 0;
 			kernel_pages_free(PHYS_TO_KERNEL(ptable));
+			*((uint_t *)pmap->pdir + k) = 0;
+			pmap->ntables--;
 		}
 	}
 	
-	kernel_pages_free(pmap->pdir);
-	kfree(pmap);
+	cache_free(pdir_cache, pmap->pdir);
+	cache_free(pmap_cache, pmap);
 	return;
 }
@@ -38,6 +38,7 @@
 #define PGHD_WRITE    0x02
 #define PGHD_EXEC     0x00
 #define PGHD_NOEXEC   0x00
+#define PGHD_GLOBAL   0x100  /* mapping survives CR3 reload (PGE) */
 
 
 /* Architecure dependent page table attributes */
@@ -46,6 +47,8 @@
 #define PTHD_USER     0x04
 #define PTHD_WRITE    0x02
 #define PTHD_READ     0x00
+#define PTHD_LARGE    0x80   /* entry maps 4 MB page (PSE) */
+#define PTHD_GLOBAL   0x100  /* 4 MB page survives CR3 reload (PGE) */
 
 
 /* Page attributes used by functions allocating memory areas */
@@ -53,48 +56,90 @@
 #define PG_RSVD      0x40000000   /* {30} page is reserved */
 #define PG_KERNEL    0x20000000   /* {29} page is used by the kernel */
 #define PG_PRESENT   0x10000000   /* {28} page is present - reserved for future */
+#define PG_BUDDY     0x08000000   /* {27} page is the head of free buddy block */
 
 
 /* Testing macros */
 #define IS_DMA(pf)    ((pf >> 31) & 1)
 #define IS_FREE(pf)   (!((pf >> 30) & 1))
 #define IS_KERNEL(pf) ((pf >> 29) & 1)
+#define IS_BUDDY(pf)  ((pf >> 27) & 1)
 
 
-/* Page descriptor used by other parts of VM subsystem */
+/*
+ * Page descriptor used by other parts of VM subsystem. Page of user page
+ * table counts its present entries in refs.
+ */
 typedef struct _page_t {
 	struct _page_t *next;       /* next page in area */
 	struct _page_t *prev;       /* previous page */
 	uint_t         flags;       /* atrybuty strony i przenaczenie */
 	uint_t         num;         /* numer strony fizycznej */
+	uint_t         order;       /* order of free buddy block (valid for PG_BUDDY pages) */
+	uint_t         refs;        /* number of references to shared page */
 } page_t;
 
 
+/* Paging features used by pmap (pmap_features) */
+#define PMAP_PSE      0x01   /* kernel linear mapping uses 4 MB pages */
+#define PMAP_PGE      0x02   /* kernel mappings are global */
+
+
 /* Machine dependent interface, used to emulate one-level page table */
 typedef struct _pmap_t {
 	uint_t npages;       /* total mapped pages */
+	uint_t ntables;      /* number of allocated page tables */
 	void *pdir;          /* addres of the page directory */
 } pmap_t;
 
 
+/* Paging features enabled by pmap_init() */
+extern uint_t pmap_features;
+
+
 /*
  * Function initializes machine dependent pmap interface. In initialization
  * procedure next kernel page tables are created (neccesary to map all physical memory
  * in kernel space). Top of the staticaly allocated kernel memory is increased.
  * num_of_ptable = 1 GB / 4 MB = 256
  * kernel_mem_top += size / PAGE_DIR_SIZE / PAGE_SIZE 
+ * When CPU supports PSE, memory above first 4 MB is mapped with 4 MB pages
+ * and no page tables are allocated. When CPU supports PGE, kernel mappings
+ * are global. Finally physical memory map is built.
  */
 extern void pmap_init(uint_t size);
 
 
-/* Function fills page_t structure for page frame given by pn */
-extern page_t *pmap_getphyspage(uint_t size, page_t *page, uint_t pn);
+/* Range of physical pages with the same attributes */
+typedef struct _pmap_range_t {
+	uint_t start;        /* first page */
+	uint_t end;          /* page following the last one */
+	uint_t flags;        /* PG_* attributes of range pages */
+} pmap_range_t;
+
+
+/*
+ * Function returns physical memory size. It is taken from the BIOS memory map
+ * passed by loader in syspage, probed size is used when the map is missing.
+ */
+extern uint_t pmap_getmemsize(uint_t probed);
+
+
+/*
+ * Function returns n-th range of physical memory. Ranges are sorted and
+ * cover all pages of memory given to pmap_init().
+ */
+extern int pmap_getrange(uint_t n, pmap_range_t *range);
 
 
 /* Function returns top of statically allocated kernel memory */
 extern uint_t pmap_get_kmem_top(void);
 
 
+/* Function initializes caches of pmap structures and page directories */
+extern int pmap_initcaches(void);
+
+
 /* Function creates empty pmap structure */
 extern pmap_t *pmap_create(void);
 
@@ -103,6 +148,24 @@ extern pmap_t *pmap_create(void);
 extern int pmap_map(pmap_t *pmap, page_t *page, void *vaddr, uint_t flags);
 
 
+/*
+ * Function maps page list at consecutive addresses starting from vaddr.
+ * Each page table is looked up once per 4 MB span.
+ */
+extern int pmap_map_range(pmap_t *pmap, page_t *pages, void *vaddr, uint_t flags);
+
+
+/*
+ * Function unmaps size bytes starting from vaddr. Only removed entries are
+ * flushed from TLB, page tables which become empty are released.
+ */
+extern void pmap_unmap_range(pmap_t *pmap, void *vaddr, uint_t size);
+
+
+/* Function returns number of physical page mapped at vaddr */
+extern int pmap_getpn(pmap_t *pmap, void *vaddr, uint_t *pn);
+
+
 /* Functions releases pmap structure */
 extern void pmap_free(pmap_t *pmap);
 
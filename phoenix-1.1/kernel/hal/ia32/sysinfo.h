@@ -40,4 +40,27 @@ typedef struct _sysinfo_t {
 } sysinfo_t;
 
 
+#define SYSPAGE_MAXMM   64     /* size of memory map table */
+#define SYSPAGE_MMFREE  1      /* type of memory usable by the system */
+
+
+/* BIOS (e820) memory map entry */
+typedef struct _syspage_mmitem_t {
+	uint_t addr;           /* base address (low 32 bits) */
+	uint_t addr_hi;
+	uint_t len;            /* length in bytes (low 32 bits) */
+	uint_t len_hi;
+	uint_t type;
+} syspage_mmitem_t;
+
+
+/* Page prepared by loader at SYSPAGE_ADDR */
+typedef struct _syspage_t {
+	uchar_t gdtr[8];
+	uchar_t idtr[8];
+	syspage_mmitem_t mm[SYSPAGE_MAXMM];
+	ushort_t mmsize;       /* number of memory map entries */
+} syspage_t;
+
+
 #endif
@@ -31,6 +31,26 @@
 #include <init/std.h>
 
 
+/*
+ * Maximal one-shot counter value. Counter has 16 bits and wraps to 0xffff
+ * after terminal count, margin lets timedev_elapsed() recognize wrapped value.
+ */
+#define TIMEDEV_MAXCOUNT  0xf000
+
+
+/*
+ * Timer state. Slices of one-shot period are reported by timedev_elapsed()
+ * incrementally, part of slice elapsed before period is ended early is carried
+ * to the next one-shot period, so time isn't lost when timer is reprogrammed.
+ */
+struct {
+	uint_t count;     /* counter value of one slice */
+	uint_t oneshot;   /* counter value of pending one-shot interrupt, 0 in periodic mode */
+	uint_t credited;  /* slices of one-shot period already reported */
+	uint_t carry;     /* counter units elapsed but not reported in previous periods */
+} timedev;
+
+
 /* Function initializes system timer. Slice parameter defines clock cycle in in microseconds */
 void timedev_init(uint_t slice)
 {
@@ -41,6 +61,10 @@ void timedev_init(uint_t slice)
 	t = slice * 1200 / 1000;
 	
 	std_printf("timedev: t=%d\n", t);
+	timedev.count = t;
+	timedev.oneshot = 0;
+	timedev.credited = 0;
+	timedev.carry = 0;
 	
 	/* First generator, operation - CE write, work mode 2, binary counting */
 	bus_outb(0x43, 0x34);
@@ -51,3 +75,87 @@ void timedev_init(uint_t slice)
 	
 	return;
 }
+
+
+/* Function returns maximal number of slices which can be skipped by one-shot interrupt */
+uint_t timedev_maxslices(void)
+{
+	return TIMEDEV_MAXCOUNT / timedev.count;
+}
+
+
+/*
+ * Function returns counter units elapsed in current one-shot period. In mode 0
+ * counter wraps after terminal count, so value greater than programmed one
+ * means that interrupt is pending.
+ */
+static uint_t timedev_counts(void)
+{
+	uint_t count;
+	
+	/* Latch counter of first generator and read it */
+	bus_outb(0x43, 0x00);
+	count = bus_inb(0x40);
+	count |= bus_inb(0x40) << 8;
+	
+	if ((count == 0) || (count > timedev.oneshot))
+		return timedev.oneshot;
+	return timedev.oneshot - count;
+}
+
+
+/* Function ends one-shot period, its unreported time is carried to the next period */
+static void timedev_stop(void)
+{
+	if (timedev.oneshot) {
+		timedev.carry += timedev_counts() - timedev.credited * timedev.count;
+		timedev.oneshot = 0;
+		timedev.credited = 0;
+	}
+	return;
+}
+
+
+/* Function programs timer to interrupt once after n slices (interrupts disabled) */
+void timedev_oneshot(uint_t n)
+{
+	timedev_stop();
+	timedev.oneshot = n * timedev.count;
+	
+	/* First generator, operation - CE write, work mode 0 (interrupt on terminal count) */
+	bus_outb(0x43, 0x30);
+	bus_outb(0x40, (uchar_t)(timedev.oneshot & 0xff));
+	bus_outb(0x40, (uchar_t)(timedev.oneshot >> 8));
+	return;
+}
+
+
+/* Function restores periodic interrupts after one-shot interrupt (interrupts disabled) */
+void timedev_periodic(void)
+{
+	timedev_stop();
+	
+	bus_outb(0x43, 0x34);
+	bus_outb(0x40, (uchar_t)(timedev.count & 0xff));
+	bus_outb(0x40, (uchar_t)(timedev.count >> 8));
+	return;
+}
+
+
+/*
+ * Function returns number of whole slices elapsed in one-shot period since
+ * the previous call (interrupts disabled). Time carried from previous periods
+ * is included.
+ */
+uint_t timedev_elapsed(void)
+{
+	uint_t total, n;
+	
+	if (!timedev.oneshot)
+		return 0;
+	
+	total = (timedev_counts() + timedev.carry) / timedev.count;
+	n = total - timedev.credited;
+	timedev.credited = total;
+	return n;
+}
@@ -34,4 +34,20 @@
 extern void timedev_init(uint_t t);
 
 
+/* Function returns maximal number of slices which can be skipped by one-shot interrupt */
+extern uint_t timedev_maxslices(void);
+
+
+/* Function programs timer to interrupt once after n slices (interrupts disabled) */
+extern void timedev_oneshot(uint_t n);
+
+
+/* Function restores periodic interrupts after one-shot interrupt (interrupts disabled) */
+extern void timedev_periodic(void);
+
+
+/* Function returns number of whole slices elapsed in one-shot period since the previous call */
+extern uint_t timedev_elapsed(void);
+
+
 #endif
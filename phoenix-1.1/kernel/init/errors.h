@@ -30,6 +30,7 @@
 
 #define ERR_OK               0
 #define ERR_ARG             -1
+#define ERR_MEM             -2
 
 #define ERR_SERIAL_TIMEOUT  -48
 
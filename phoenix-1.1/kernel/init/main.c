@@ -28,6 +28,7 @@
 #include <init/std.h>
 #include <vm/vm.h>
 #include <vm/kmalloc.h>
+#include <vm/shm.h>
 #include <task/timesys.h>
 #include <task/scheduler.h>
 #include <task/exec.h>
@@ -40,22 +41,54 @@
 extern uint_t physmem_size;
 
 
+/*
+ * Idle thread, interrupt which made task ready ends one-shot timer period.
+ * Runnable tasks are checked with interrupts disabled and sti; hlt sequence
+ * halts before any interrupt is delivered, so wakeup isn't missed.
+ */
 int task_idle(void)
 {
 	for (;;) {
-		__hlt();
+		cli();
+		if (scheduler_runnable()) {
+			sti();
+			reschedule();
+		}
+		else
+			__sti_hlt();
 	}		 
 	return 0;
 }
 
 
+/*
+ * Thread zeroes free pages in background, pool is refilled in small batches.
+ * When pool is full kmalloc magazines are drained, so empty areas are released.
+ */
+int task_zero(void)
+{
+	for (;;) {
+		if (!zeropool_fill(8)) {
+			kmalloc_reclaim();
+			sleep_unintr(100);
+		}
+	}
+	return 0;
+}
+
+
 int task_run(void)
 {
+	task_t *task;
 	uint_t k;
 
-	/* Run idle tasks */
-	for (k = 0; k < 2; k++)
-		create_kernel_thread("idle", task_idle, NULL, 0);
+	/* Run idle tasks, page zeroing runs only when there is nothing else to do */
+	for (k = 0; k < 2; k++) {
+		if ((task = create_kernel_thread("idle", task_idle, NULL, 0)) != NULL)
+			scheduler_setpriority(task->id, PRIORITY_IDLE);
+	}
+	if ((task = create_kernel_thread("zero", task_zero, NULL, 0)) != NULL)
+		scheduler_setpriority(task->id, PRIORITY_IDLE - 1);
 
 	/* Execute Phoenix shell */
 	exec("psh");
@@ -84,6 +117,7 @@ int main(void)
 	std_printf("-\\- Phoenix microkernel, ver. 1.1, (c) Pawel Pisarczyk, 2001, 2005\n");
 	std_printf("-----------------------------------------------------------------\n");
 	std_printf("disabling A20 gate\n");
+	physmem_size = pmap_getmemsize(physmem_size);
 	std_printf("testing physical memory [%d KB detected]\n", physmem_size / 1024);
 	std_printf("starting paging\n");
 	std_printf("enabling interrupts\n");
@@ -95,12 +129,26 @@ int main(void)
 		std_printf("[VGA-mono detected]\n");
 
 	/* Initialize virtual memory managment */
-	std_printf("initializing pmap interface\n");	
+	std_printf("initializing pmap interface ");	
 	pmap_init(physmem_size);		
+	if (pmap_features & PMAP_PSE)
+		std_printf("[4 MB pages");
+	else
+		std_printf("[4 KB pages");
+	if (pmap_features & PMAP_PGE)
+		std_printf(", global");
+	std_printf("]\n");
 	init_mem_map(physmem_size);		
 	std_printf("creating memory map\n");
 	std_printf("initializing kmalloc subsystem\n");	
 	kmalloc_init(2);	
+	std_printf("creating object caches\n");
+	if ((vm_init() < 0) || (task_init() < 0)) {
+		std_printf("KERNEL PANIC! Can't create object caches!\n");
+		for (;;)
+			__hlt()
+	}
+	shm_init();
 	disp_meminfo();
 	
 	/* Initialize system timer */
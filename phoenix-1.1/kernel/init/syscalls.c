@@ -29,6 +29,7 @@
 #include <task/if.h>
 #include <comm/signals.h>
 #include <init/ramdisk.h>
+#include <vm/shm.h>
 
 
 #define SYSCALL(p) ((void *)p)
@@ -63,5 +64,12 @@ sysent_t sysents[] = {
 	{ SYSCALL(&psc_sigset), "sigset", 3, 0 },
 	{ SYSCALL(&sleep_unintr), "sleep_unintr", 1, 0 },
 	{ SYSCALL(&get_ramdisk_info), "get_ramdisk_info", 2, 0 },
-	{ SYSCALL(hal_inject), "hal_inject", 3, 0 }
+	{ SYSCALL(hal_inject), "hal_inject", 3, 0 },           /* 16 */
+	{ SYSCALL(&psc_shmcreate), "shmcreate", 3, 0 },
+	{ SYSCALL(&psc_shmattach), "shmattach", 4, 0 },
+	{ SYSCALL(&psc_shmdetach), "shmdetach", 2, 0 },
+	{ SYSCALL(&psc_shmremove), "shmremove", 2, 0 },           /* 20 */
+	{ SYSCALL(&psc_sbrk), "sbrk", 2, 0 },
+	{ SYSCALL(&get_memstats), "getmemstats", 1, 0 },
+	{ SYSCALL(&psc_setpriority), "setpriority", 3, 0 }
 };
@@ -36,7 +36,7 @@
 #define MSG_OPEN    1
 #define MSG_READ    2
 #define MSG_WRITE   3
-#define MSG_COPY    4
+#define MSG_CLOSE   4
 
 
 typedef struct _msg_phfsio_t {
@@ -53,4 +53,7 @@ extern int phfs_open(u16 dn, char *name, u32 flags);
 extern int phfs_read(u16 dn, int handle, u32 *pos, u8 *buff, u32 len);
 
 
+extern int phfs_close(u16 dn, int handle);
+
+
 #endif
@@ -27,6 +27,55 @@
 #include <phfs/if.h>
 #include <init/errors.h>
 #include <init/std.h>
+#include <task/timesys.h>
+
+
+/*
+ * Messages of different tasks can't be interleaved on the serial line. Tasks
+ * may read files concurrently since executables are loaded on page faults.
+ * Message exchange sleeps, so phfs_busy is the sleeping lock and the spin
+ * lock only protects it.
+ */
+mutex_t phfs_mutex = 1;
+static uint_t phfs_busy = 0;
+
+
+/* Function waits until phfs is not used by other task and takes it */
+static void phfs_lock(void)
+{
+	uint_t eflags;
+	
+	for (;;) {
+		eflags = cli_save();
+		lock(&phfs_mutex);
+		if (!phfs_busy) {
+			phfs_busy = 1;
+			unlock(&phfs_mutex);
+			restore_flags(eflags);
+			return;
+		}
+		unlock(&phfs_mutex);
+		restore_flags(eflags);
+		
+		sleep_on_unintr(0, &phfs_busy, 1);
+	}
+}
+
+
+/* Function releases phfs and wakes up waiting tasks */
+static void phfs_unlock(void)
+{
+	uint_t eflags;
+	
+	eflags = cli_save();
+	lock(&phfs_mutex);
+	phfs_busy = 0;
+	unlock(&phfs_mutex);
+	restore_flags(eflags);
+	
+	wakeup_on(&phfs_busy);
+	return;
+}
 
 
 int phfs_open(u16 dn, char *name, u32 flags)
@@ -44,8 +93,12 @@ int phfs_open(u16 dn, char *name, u32 flags)
 	msg_settype(&smsg, MSG_OPEN);
 	msg_setlen(&smsg, l);
 
-	if (msg_send(dn, &smsg, &rmsg) < 0)
+	phfs_lock();
+	if (msg_send(dn, &smsg, &rmsg) < 0) {
+		phfs_unlock();
 		return ERR_PHFS_IO;
+	}
+	phfs_unlock();
 	
 	if (msg_gettype(&rmsg) != MSG_OPEN)
 		return ERR_PHFS_PROTO;
@@ -79,8 +132,12 @@ int phfs_read(u16 dn, int handle, u32 *pos, u8 *buff, u32 len)
 	msg_settype(&smsg, MSG_READ);
 	msg_setlen(&smsg, hdrsz);
 	
-	if (msg_send(dn, &smsg, &rmsg) < 0)
+	phfs_lock();
+	if (msg_send(dn, &smsg, &rmsg) < 0) {
+		phfs_unlock();
 		return ERR_PHFS_IO;
+	}
+	phfs_unlock();
 	
 	if (msg_gettype(&rmsg) != MSG_READ)
 		return ERR_PHFS_PROTO;
@@ -96,3 +153,26 @@ int phfs_read(u16 dn, int handle, u32 *pos, u8 *buff, u32 len)
 	return l;
 }
 
+
+int phfs_close(u16 dn, int handle)
+{
+	msg_t smsg, rmsg;
+	
+	if (handle <= 0)
+		return ERR_ARG;
+	
+	*(u32 *)smsg.data = handle;
+	msg_settype(&smsg, MSG_CLOSE);
+	msg_setlen(&smsg, sizeof(u32));
+	
+	phfs_lock();
+	if (msg_send(dn, &smsg, &rmsg) < 0) {
+		phfs_unlock();
+		return ERR_PHFS_IO;
+	}
+	phfs_unlock();
+	
+	if (msg_gettype(&rmsg) != MSG_CLOSE)
+		return ERR_PHFS_PROTO;
+	return 0;
+}
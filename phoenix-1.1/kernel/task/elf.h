@@ -55,6 +55,10 @@ typedef int            Elf32_Sword;
 #define PT_LOPROC     0x70000000
 #define PT_HIPROC     0x7fffffff
 
+#define PF_X          0x1
+#define PF_W          0x2
+#define PF_R          0x4
+
 
 #pragma pack(1)
 
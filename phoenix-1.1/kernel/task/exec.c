@@ -29,101 +29,179 @@
 #include <init/errors.h>
 #include <task/elf.h>
 #include <task/task.h>
-#include <phfs/if.h>
+#include <task/exec.h>
+#include <task/image.h>
+#include <task/scheduler.h>
+#include <vm/kmalloc.h>
 
 
-/* Function loads Phoenix user program, creates new task and starts execution */
+/*
+ * Function loads Phoenix user program, creates new task and starts execution.
+ * Segments are only described here, their pages are taken from the program
+ * image by exec_pagefault() on first access.
+ */
 int exec(char *name)
 {
-	int h, err;
-	u32 pos = 0;
-	Elf32_Ehdr ehdr;
-	Elf32_Phdr phdr;
-	void *addr;
-	uint_t k, npages, i;
-	page_t *tp = NULL;
+	int err;
+	uint_t k, l;
+	image_t *image;
+	image_seg_t *iseg;
+	page_t **shared;
 	vm_seg_t *seg;
 	vm_map_t *map;
-	uint_t flags = 0;
+	void *end;
 	
-	if ((h = phfs_open(0, name, 0)) < 0) {
-		std_printf("Can't open file '%s' [err=%p]!\n", name, h);
-		return h;
-	}
-
-	/* Read header */
-	if ((err = phfs_read(0, h, &pos, (u8 *)&ehdr, sizeof(ehdr))) < 0) {
-		std_printf("Can't read file [err=%p]!\n", err);
+	if ((image = image_get(name, &err)) == NULL)
 		return err;
-	}
-		
-	if ((ehdr.e_ident[0] != 0x7f) && (ehdr.e_ident[1] != 'E') &&
-	    (ehdr.e_ident[2] != 'L') && (ehdr.e_ident[3] != 'F')) {
-		std_printf("Bad executable!\n");
-		return ERR_ARG;
-	}
 	
-	/* Create virtual memory map for new task */
+	/* Create virtual memory map for new task, image is released with the map */
 	if ((map = map_create()) == NULL) {
-		return -1;
+		image_put(image);
+		return ERR_MEM;
 	}
+	map->image = image;
 	
-	/* Load program sections */
-	for (k = 0; k < ehdr.e_phnum; k++) {
-	
-		/* Read program header */
-		pos = ehdr.e_phoff + k * sizeof(Elf32_Phdr);
+	/* Create and map virtual memory segments */
+	for (k = 0; k < image->nsegs; k++) {
+		iseg = &image->segs[k];
+		
+		l = iseg->size / PAGE_SIZE * sizeof(page_t *);
+		if ((shared = (page_t **)kmalloc(l)) == NULL) {
+			exec_release(map);
+			map_free(map);
+			return ERR_MEM;
+		}
+		memclr(shared, l);
+		
+		if ((seg = seg_create(NULL, iseg->vaddr, iseg->size, iseg->flags)) == NULL) {
+			kfree(shared);
+			exec_release(map);
+			map_free(map);
+			return ERR_MEM;
+		}
+		seg->source = iseg;
+		seg->shared = shared;
 		
-		if ((err = phfs_read(0, h, &pos, (u8 *)&phdr, sizeof(phdr))) < 0) {
-			std_printf("Can't read file [err=%p]!\n", err);
-			return err;
+		/* Rejected segment is released by seg_map() */
+		if (seg_map(map, seg)) {
+			exec_release(map);
+			map_free(map);
+			return ERR_MEM;
 		}
+		
+		end = iseg->vaddr + iseg->size;
+		if (end > map->heap_base)
+			map->heap_base = end;
+	}
+	
+	/* Heap starts at the first page above the image */
+	map->heap_base = (void *)(((uint_t)map->heap_base + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+
+	/* Create new user task */
+	if (create_task(name, map, image->entry, PRIORITY_DEFAULT) == NULL) {
+		exec_release(map);
+		map_free(map);
+		return ERR_MEM;
+	}
+
+	return 0;
+}
 
-		if ((phdr.p_type == PT_LOAD) && (phdr.p_vaddr != 0)) {
 
-			/* Alloc memory for the new program section */
-			npages = (phdr.p_filesz % PAGE_SIZE) ? phdr.p_filesz / PAGE_SIZE + 1 : phdr.p_filesz / PAGE_SIZE;
-			if ((tp = area_alloc(npages, REG_MEM)) == NULL) {
-				map_free(map);
-				return -1;
-			}
-			
-			addr = (uchar_t *)(KERNEL_BASE + tp->num * PAGE_SIZE);
-			
-			/* Read data from file to memory */
-			pos = phdr.p_offset;
-			for (i = 0; i < phdr.p_filesz / (MSG_MAXLEN - 64); i++) {		
-				
-				if ((err = phfs_read(0, h, &pos, addr, MSG_MAXLEN - 64)) < 0) {
-					std_printf("Can't read file [err=%p]!\n", err);
-					return err;
-				}
-				
-				addr += (MSG_MAXLEN - 64);
-			}
-			phfs_read(0, h, &pos, addr, phdr.p_filesz % (MSG_MAXLEN - 64));
- 
-			/* Create and map virtual memory segment */
-			flags |= (PGHD_EXEC | PGHD_WRITE | PGHD_READ | PGHD_USER | PGHD_PRESENT);
-			seg = seg_create(tp, (void *)phdr.p_vaddr, flags);
+/* Function maps private copy of page to segment */
+static int exec_copypage(vm_map_t *map, vm_seg_t *seg, page_t *src, void *vaddr)
+{
+	page_t *page;
+	
+	if ((page = area_alloc(1, REG_MEM)) == NULL)
+		return -1;
+	
+	memcpy((void *)(KERNEL_BASE + page->num * PAGE_SIZE), (void *)(KERNEL_BASE + src->num * PAGE_SIZE), PAGE_SIZE);
+	
+	if (seg_mappage(map, seg, page, vaddr) < 0) {
+		area_free(page);
+		return -1;
+	}
+	return 0;
+}
 
-			if (!seg) {
-				map_free(map);	
-				return -1;
-			}
 
-			if (seg_map(map, seg)) {
-				map_free(map);
-				return -1;
-			}
+/*
+ * Function resolves page fault of user task. Image pages are mapped shared,
+ * pages of writable segments are copied on write. Pages without file data
+ * are allocated and zeroed.
+ */
+int exec_pagefault(task_t *task, void *vaddr, uint_t attr)
+{
+	vm_map_t *map = task->vm_map;
+	vm_seg_t *seg;
+	image_seg_t *iseg;
+	page_t *page;
+	uint_t idx;
+	
+	vaddr = (void *)((uint_t)vaddr & ~(PAGE_SIZE - 1));
+	if ((seg = seg_find(map, vaddr)) == NULL)
+		return -1;
+	idx = (vaddr - seg->vaddr) / PAGE_SIZE;
+	
+	/* Write to shared page of writable segment - copy on write */
+	if (attr & VM_FAULT_PROT) {
+		if (!(attr & VM_FAULT_WRITE) || !(seg->flags & PGHD_WRITE) ||
+		    (seg->shared == NULL) || ((page = seg->shared[idx]) == NULL))
+			return -1;
+		
+		if (exec_copypage(map, seg, page, vaddr) < 0)
+			return -1;
+		seg->shared[idx] = NULL;
+		page_unref(page);
+		return 0;
+	}
+	
+	/* Anonymous page */
+	iseg = seg->source;
+	if ((iseg == NULL) || ((seg->pgoff + idx) * PAGE_SIZE >= iseg->filesz)) {
+		if ((page = area_alloc(1, REG_MEM | AREA_ZERO)) == NULL)
+			return -1;
 		
+		if (seg_mappage(map, seg, page, vaddr) < 0) {
+			area_free(page);
+			return -1;
+		}
+		return 0;
+	}
+	
+	/* Image page */
+	if ((page = image_getpage(map->image, iseg, seg->pgoff + idx)) == NULL)
+		return -1;
+	
+	/* Writable segment gets private copy at once when the first access is write */
+	if ((attr & VM_FAULT_WRITE) && (seg->flags & PGHD_WRITE)) {
+		if (exec_copypage(map, seg, page, vaddr) < 0) {
+			page_unref(page);
+			return -1;
 		}
+		page_unref(page);
+		return 0;
 	}
+	
+	if (pmap_map(map->pmap, page, vaddr, seg->flags & ~PGHD_WRITE) < 0) {
+		page_unref(page);
+		return -1;
+	}
+	seg->shared[idx] = page;
+	return 0;
+}
 
-	/* Create new user task */
-	create_task(name, map, (void *)ehdr.e_entry, 0);
 
-	return 0;
+/* Function releases segments of memory map and its reference to program image */
+void exec_release(vm_map_t *map)
+{
+	release_segs(map);
+	
+	if (map->image != NULL)
+		image_put(map->image);
+	map->image = NULL;
+	return;
 }
 
 
@@ -133,3 +211,13 @@ void psc_exec(char *name, int *err)
 	*err = exec(name);
 	return;
 }
+
+
+/* map_sbrk (PSC) */
+void psc_sbrk(int incr, void **addr)
+{
+	task_t *task = scheduler_getcurrent();
+	
+	*addr = (task->vm_map != NULL) ? map_sbrk(task->vm_map, incr) : NULL;
+	return;
+}
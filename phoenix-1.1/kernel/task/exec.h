@@ -27,6 +27,9 @@
 #ifndef _EXEC_H_
 #define _EXEC_H_
 
+#include <vm/vm.h>
+#include <task/task.h>
+
 
 /*
  * Function loads Phoenix user program from parent using BSP protocol, creates
@@ -35,8 +38,24 @@
 extern int exec(char *name);
 
 
+/*
+ * Function resolves page fault of user task. Image pages are mapped shared,
+ * pages of writable segments are copied on write. Pages without file data
+ * are allocated and zeroed.
+ */
+extern int exec_pagefault(task_t *task, void *vaddr, uint_t attr);
+
+
+/* Function releases segments of memory map and its reference to program image */
+extern void exec_release(vm_map_t *map);
+
+
 /* exec (PSC) */
 extern void psc_exec(char *name, int *err);
 
 
+/* map_sbrk (PSC) */
+extern void psc_sbrk(int incr, void **addr);
+
+
 #endif
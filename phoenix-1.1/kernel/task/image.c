@@ -0,0 +1,403 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Executable image cache
+ *
+ * Copyright 2001 Pawel Pisarczyk
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * Phoenix-RTOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Phoenix-RTOS kernel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Phoenix-RTOS kernel; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <hal/current/if.h>
+#include <init/std.h>
+#include <init/errors.h>
+#include <vm/vm.h>
+#include <vm/kmalloc.h>
+#include <task/elf.h>
+#include <task/image.h>
+#include <phfs/if.h>
+
+
+/* Cache of images, the most recently used first */
+struct {
+	mutex_t mutex;
+	image_t *images;
+} image_cache = { 1, NULL };
+
+
+/* Function computes checksum of data */
+static u32 image_csum(u32 csum, u8 *data, uint_t len)
+{
+	uint_t k;
+	
+	for (k = 0; k < len; k++)
+		csum = (csum << 5) + csum + data[k];
+	return csum;
+}
+
+
+/* Function compares image names */
+static int image_namecmp(char *s1, char *s2)
+{
+	for (; *s1 && (*s1 == *s2); s1++, s2++);
+	return *s1 != *s2;
+}
+
+
+/* Function releases image with its pages and closes executable file */
+static void image_destroy(image_t *image)
+{
+	uint_t k, i;
+	
+	for (k = 0; k < image->nsegs; k++) {
+		for (i = 0; i < image->segs[k].size / PAGE_SIZE; i++)
+			if (image->segs[k].pages[i] != NULL)
+				page_unref(image->segs[k].pages[i]);
+		kfree(image->segs[k].pages);
+	}
+	
+	phfs_close(0, image->handle);
+	kfree(image);
+	return;
+}
+
+
+/* Function removes image from cache list, cache must be locked */
+static void image_remove(image_t *image)
+{
+	if (image->prev != NULL)
+		image->prev->next = image->next;
+	else
+		image_cache.images = image->next;
+	
+	if (image->next != NULL)
+		image->next->prev = image->prev;
+	
+	image->next = NULL;
+	image->prev = NULL;
+	return;
+}
+
+
+/* Function inserts image at the head of cache list, cache must be locked */
+static void image_insert(image_t *image)
+{
+	image->prev = NULL;
+	image->next = image_cache.images;
+	if (image_cache.images != NULL)
+		image_cache.images->prev = image;
+	image_cache.images = image;
+	return;
+}
+
+
+/*
+ * Function removes and returns the least recently used unused image when
+ * there are more than IMAGE_CACHED unused images. Cache must be locked.
+ */
+static image_t *image_trim(void)
+{
+	image_t *image, *lru = NULL;
+	uint_t unused = 0;
+	
+	for (image = image_cache.images; image != NULL; image = image->next) {
+		if (!image->refs) {
+			unused++;
+			lru = image;
+		}
+	}
+	
+	if (unused <= IMAGE_CACHED)
+		return NULL;
+	
+	image_remove(lru);
+	return lru;
+}
+
+
+/*
+ * Function adds section header table to image stamp. Table describes sizes
+ * and offsets of all sections, symbol tables included, so it changes when
+ * program is rebuilt, and it's read in a few messages.
+ */
+static int image_hashshdrs(image_t *image, Elf32_Ehdr *ehdr)
+{
+	u8 buff[MSG_MAXLEN - 64];
+	u32 pos = ehdr->e_shoff;
+	uint_t i, len;
+	int n;
+	
+	len = min((uint_t)ehdr->e_shnum * ehdr->e_shentsize, IMAGE_SHDRSZ);
+	if (!ehdr->e_shoff)
+		len = 0;
+	
+	for (i = 0; i < len; i += n) {
+		if ((n = phfs_read(0, image->handle, &pos, buff, min(len - i, sizeof(buff)))) < 0)
+			return n;
+		if (!n)
+			break;
+		image->stamp = image_csum(image->stamp, buff, n);
+	}
+	return 0;
+}
+
+
+/*
+ * Function reads headers of executable file and creates image. Image stamp
+ * covers ELF, program and section headers, so rebuilt program isn't mixed
+ * with cached pages of the old one.
+ */
+static image_t *image_load(char *name, int h, int *err)
+{
+	image_t *image;
+	image_seg_t *iseg;
+	Elf32_Ehdr ehdr;
+	Elf32_Phdr phdr;
+	uint_t k, offs, l;
+	u32 pos = 0;
+	
+	/* Read header */
+	if ((*err = phfs_read(0, h, &pos, (u8 *)&ehdr, sizeof(ehdr))) < 0) {
+		std_printf("Can't read file [err=%p]!\n", *err);
+		return NULL;
+	}
+	
+	if ((ehdr.e_ident[0] != 0x7f) && (ehdr.e_ident[1] != 'E') &&
+	    (ehdr.e_ident[2] != 'L') && (ehdr.e_ident[3] != 'F')) {
+		std_printf("Bad executable!\n");
+		*err = ERR_ARG;
+		return NULL;
+	}
+	
+	if ((image = (image_t *)kmalloc(sizeof(image_t))) == NULL) {
+		*err = ERR_MEM;
+		return NULL;
+	}
+	
+	if ((l = std_strlen(name)) > TASK_NAME_SIZE)
+		l = TASK_NAME_SIZE;
+	memcpy(image->name, name, l);
+	image->name[l] = 0;
+	
+	image->next = NULL;
+	image->prev = NULL;
+	image->handle = h;
+	image->refs = 1;
+	image->stale = 0;
+	image->entry = (void *)ehdr.e_entry;
+	image->nsegs = 0;
+	image->stamp = image_csum(5381, (u8 *)&ehdr, sizeof(ehdr));
+	unlock(&image->mutex);
+	
+	/* Describe program sections */
+	for (k = 0; k < ehdr.e_phnum; k++) {
+		pos = ehdr.e_phoff + k * sizeof(Elf32_Phdr);
+		
+		if ((*err = phfs_read(0, h, &pos, (u8 *)&phdr, sizeof(phdr))) < 0) {
+			std_printf("Can't read file [err=%p]!\n", *err);
+			break;
+		}
+		image->stamp = image_csum(image->stamp, (u8 *)&phdr, sizeof(phdr));
+		
+		if ((phdr.p_type != PT_LOAD) || (phdr.p_vaddr == 0))
+			continue;
+		
+		if (image->nsegs == IMAGE_MAXSEGS) {
+			std_printf("Too many segments in executable!\n");
+			*err = ERR_ARG;
+			break;
+		}
+		
+		/* Segment begins on page boundary, memory beyond file data is zeroed */
+		iseg = &image->segs[image->nsegs];
+		offs = phdr.p_vaddr & (PAGE_SIZE - 1);
+		iseg->vaddr = (void *)(phdr.p_vaddr - offs);
+		iseg->size = offs + ((phdr.p_memsz > phdr.p_filesz) ? phdr.p_memsz : phdr.p_filesz);
+		iseg->size = (iseg->size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+		iseg->offs = phdr.p_offset - offs;
+		iseg->filesz = phdr.p_filesz + offs;
+		iseg->flags = PGHD_PRESENT | PGHD_USER | PGHD_READ;
+		if (phdr.p_flags & PF_W)
+			iseg->flags |= PGHD_WRITE;
+		if (phdr.p_flags & PF_X)
+			iseg->flags |= PGHD_EXEC;
+		
+		l = iseg->size / PAGE_SIZE * sizeof(page_t *);
+		if ((iseg->pages = (page_t **)kmalloc(l)) == NULL) {
+			*err = ERR_MEM;
+			break;
+		}
+		memclr(iseg->pages, l);
+		image->nsegs++;
+	}
+	
+	if (k < ehdr.e_phnum) {
+		image->handle = 0;
+		image_destroy(image);
+		return NULL;
+	}
+	
+	if ((*err = image_hashshdrs(image, &ehdr)) < 0) {
+		std_printf("Can't read file [err=%p]!\n", *err);
+		image->handle = 0;
+		image_destroy(image);
+		return NULL;
+	}
+	
+	*err = 0;
+	return image;
+}
+
+
+/*
+ * Function returns referenced image of program. When cached image has
+ * different version new image is created.
+ */
+image_t *image_get(char *name, int *err)
+{
+	image_t *image, *cached, *old = NULL;
+	int h;
+	
+	if ((h = phfs_open(0, name, 0)) < 0) {
+		std_printf("Can't open file '%s' [err=%p]!\n", name, h);
+		*err = h;
+		return NULL;
+	}
+	
+	/* Headers are read for every exec to find out program version */
+	if ((image = image_load(name, h, err)) == NULL) {
+		phfs_close(0, h);
+		return NULL;
+	}
+	
+	lock(&image_cache.mutex);
+	
+	for (cached = image_cache.images; cached != NULL; cached = cached->next)
+		if (!image_namecmp(cached->name, image->name))
+			break;
+	
+	/* Cached image is up to date - use it */
+	if ((cached != NULL) && (cached->stamp == image->stamp)) {
+		cached->refs++;
+		image_remove(cached);
+		image_insert(cached);
+		unlock(&image_cache.mutex);
+		
+		image_destroy(image);
+		return cached;
+	}
+	
+	/* Old version is released when it becomes unused */
+	if (cached != NULL) {
+		image_remove(cached);
+		if (cached->refs)
+			cached->stale = 1;
+		else
+			old = cached;
+	}
+	
+	image_insert(image);
+	if (old == NULL)
+		old = image_trim();
+	unlock(&image_cache.mutex);
+	
+	if (old != NULL)
+		image_destroy(old);
+	return image;
+}
+
+
+/* Function drops reference to image */
+void image_put(image_t *image)
+{
+	image_t *old;
+	
+	lock(&image_cache.mutex);
+	
+	if (--image->refs) {
+		unlock(&image_cache.mutex);
+		return;
+	}
+	
+	old = image->stale ? image : image_trim();
+	unlock(&image_cache.mutex);
+	
+	if (old != NULL)
+		image_destroy(old);
+	return;
+}
+
+
+/*
+ * Function returns referenced page of image segment. Page is read from file
+ * on first access. Image mutex isn't held during file read, which may block,
+ * so tasks faulting on the same page can read it concurrently - the first
+ * filled page is used and the others are released.
+ */
+page_t *image_getpage(image_t *image, image_seg_t *iseg, uint_t idx)
+{
+	page_t *page, *filled;
+	void *addr;
+	uint_t offs, len, i;
+	u32 pos;
+	int n;
+	
+	lock(&image->mutex);
+	if ((page = iseg->pages[idx]) != NULL) {
+		page_ref(page);
+		unlock(&image->mutex);
+		return page;
+	}
+	unlock(&image->mutex);
+	
+	if ((page = area_alloc(1, REG_MEM)) == NULL)
+		return NULL;
+	addr = (void *)(KERNEL_BASE + page->num * PAGE_SIZE);
+	
+	offs = idx * PAGE_SIZE;
+	len = (offs < iseg->filesz) ? min(PAGE_SIZE, iseg->filesz - offs) : 0;
+	pos = iseg->offs + offs;
+	
+	/* Read file part of the page, data above end of file is zeroed */
+	for (i = 0; i < len; i += n) {
+		if ((n = phfs_read(0, image->handle, &pos, addr + i, min(len - i, MSG_MAXLEN - 64))) < 0) {
+			std_printf("Can't read file [err=%p]!\n", n);
+			area_free(page);
+			return NULL;
+		}
+		if (!n)
+			break;
+	}
+	memclr(addr + i, PAGE_SIZE - i);
+	
+	/* Image holds one reference, page filled in meantime by other task wins */
+	lock(&image->mutex);
+	if ((filled = iseg->pages[idx]) == NULL) {
+		page->refs = 1;
+		iseg->pages[idx] = page;
+		filled = page;
+		page = NULL;
+	}
+	page_ref(filled);
+	unlock(&image->mutex);
+	
+	if (page != NULL)
+		area_free(page);
+	return filled;
+}
@@ -0,0 +1,95 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Executable image cache
+ *
+ * Copyright 2001 Pawel Pisarczyk
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * Phoenix-RTOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Phoenix-RTOS kernel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Phoenix-RTOS kernel; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _IMAGE_H_
+#define _IMAGE_H_
+
+#include <hal/current/types.h>
+#include <vm/vm.h>
+#include <task/task.h>
+
+
+/* Maximal number of loadable segments in executable */
+#define IMAGE_MAXSEGS  4
+
+/* Number of unused images kept in cache */
+#define IMAGE_CACHED   8
+
+/* Maximal size of section header table added to image stamp */
+#define IMAGE_SHDRSZ   2048
+
+
+/* Loadable segment of executable image */
+typedef struct _image_seg_t {
+	void *vaddr;             /* page aligned virtual address */
+	uint_t size;             /* segment size in memory (whole pages) */
+	uint_t offs;             /* file offset of the first page */
+	uint_t filesz;           /* number of bytes stored in file */
+	uint_t flags;            /* protection attributes */
+	page_t **pages;          /* pages read from file, filled on first access */
+} image_seg_t;
+
+
+/*
+ * Executable image - program pages read from file are shared by all tasks
+ * running the same program version. Version is identified by stamp, which
+ * is computed from ELF, program and section headers, file data isn't read
+ * on exec.
+ */
+typedef struct _image_t {
+	struct _image_t *next;
+	struct _image_t *prev;
+	char name[TASK_NAME_SIZE + 1];
+	u32 stamp;               /* checksum of headers */
+	int handle;              /* phfs handle of executable file */
+	uint_t refs;             /* number of memory maps using image */
+	uint_t stale;            /* image was replaced by newer version */
+	mutex_t mutex;           /* protects page tables of segments */
+	void *entry;             /* program entry point */
+	uint_t nsegs;
+	image_seg_t segs[IMAGE_MAXSEGS];
+} image_t;
+
+
+/*
+ * Function returns referenced image of program. When cached image has
+ * different version new image is created.
+ */
+extern image_t *image_get(char *name, int *err);
+
+
+/* Function drops reference to image */
+extern void image_put(image_t *image);
+
+
+/*
+ * Function returns referenced page of image segment. Page is read from file
+ * on first access.
+ */
+extern page_t *image_getpage(image_t *image, image_seg_t *iseg, uint_t idx);
+
+
+#endif
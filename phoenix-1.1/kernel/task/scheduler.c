@@ -29,9 +29,21 @@
 #include <vm/vm.h>
 #include <vm/kmalloc.h>
 #include <task/task.h>
+#include <task/scheduler.h>
+#include <task/timesys.h>
+#include <comm/signals.h>
 
 
-/* Scheduler queue */
+/* Size of task identifier hash table, must be power of 2 */
+#define SCHEDULER_HASHSZ  64
+
+
+/*
+ * Scheduler queue. All tasks are kept on the tasks list, ready and starting
+ * tasks are kept also on ready queues of their priorities. Bit k of ready is
+ * set when queue k isn't empty. Running task isn't queued. Tasks leave the
+ * queues only through scheduler_block() and return through scheduler_wakeup().
+ */
 struct {
 	mutex_t mutex;
 	uint_t ntasks;    /* number of tasks in queue */
@@ -39,9 +51,80 @@ struct {
 	task_t *current;  /* current */
 	uint_t depth;     /* interrupt depth - field used to prevent interrupt cascading */
 	uint_t lastid;    /* last allocated identifier */
+	uint_t ready;     /* bitmap of nonempty ready queues */
+	task_t *queues[NPRIORITIES];  /* circular ready queues */
+	task_t *hash[SCHEDULER_HASHSZ];  /* tasks hashed by identifier */
 } scheduler;
 
 
+/* Function finds task given by pid in identifier hash table (without locking) */
+static task_t *scheduler_find(uint_t pid)
+{
+	task_t *task;
+	
+	for (task = scheduler.hash[pid & (SCHEDULER_HASHSZ - 1)]; task != NULL; task = task->hnext)
+		if (task->id == pid)
+			break;
+	return task;
+}
+
+
+/* Function removes task from identifier hash table (without locking) */
+static void scheduler_unhash(task_t *task)
+{
+	task_t **prev;
+	
+	for (prev = &scheduler.hash[task->id & (SCHEDULER_HASHSZ - 1)]; *prev != NULL; prev = &(*prev)->hnext)
+		if (*prev == task) {
+			*prev = task->hnext;
+			break;
+		}
+	return;
+}
+
+
+/* Function appends task to the ready queue of its priority (without locking) */
+static void scheduler_enqueue(task_t *task)
+{
+	task_t **queue = &scheduler.queues[task->priority];
+	
+	if (*queue == NULL) {
+		*queue = task;
+		task->rnext = task;
+		task->rprev = task;
+		scheduler.ready |= (1 << task->priority);
+	}
+	else {
+		task->rnext = *queue;
+		task->rprev = (*queue)->rprev;
+		(*queue)->rprev->rnext = task;
+		(*queue)->rprev = task;
+	}
+	return;
+}
+
+
+/* Function removes task from its ready queue (without locking) */
+static void scheduler_dequeue(task_t *task)
+{
+	task_t **queue = &scheduler.queues[task->priority];
+	
+	if (task->rnext == task) {
+		*queue = NULL;
+		scheduler.ready &= ~(1 << task->priority);
+	}
+	else {
+		task->rprev->rnext = task->rnext;
+		task->rnext->rprev = task->rprev;
+		if (*queue == task)
+			*queue = task->rnext;
+	}
+	task->rnext = NULL;
+	task->rprev = NULL;
+	return;
+}
+
+
 /* Function locks scheduler */
 void scheduler_lock(void)
 {
@@ -82,10 +165,9 @@ task_t *scheduler_getcurrent(void)
 
 /*
  * Function returns scheduler depth. When scheduler is called depth is increased,
- * when leaved depth is decreased. This functions is very important because
- * during scheduling function execution interrupts are unmasked. In some cases,
- * when scheduling duration time is to long, interrupts are cascaded
- * and scheduler depth informs about this fact and prevents deadlock.
+ * when leaved depth is decreased. Scheduling function runs with interrupts
+ * masked, because device interrupts wake tasks under scheduler lock. Depth
+ * still prevents timer handler from entering scheduler recursively.
  */
 uint_t scheduler_depth(void)
 {
@@ -120,6 +202,10 @@ uint_t scheduler_getntasks(void)
 /* Function adds task to queue */
 void scheduler_addtask(task_t *task)
 {
+	uint_t eflags;
+	
+	/* Scheduler lock is taken by timer interrupt, so interrupts are disabled */
+	eflags = cli_save();
 	lock(&scheduler.mutex);
 	
 	if (scheduler.tasks == NULL) {
@@ -136,24 +222,40 @@ void scheduler_addtask(task_t *task)
 	}
 	scheduler.ntasks++;
 	task->state = TASK_STARTING;
+	scheduler_enqueue(task);
 	
 	/* (MOD) */
 	task->id = ++scheduler.lastid;
+	task->hnext = scheduler.hash[task->id & (SCHEDULER_HASHSZ - 1)];
+	scheduler.hash[task->id & (SCHEDULER_HASHSZ - 1)] = task;
+	task->zombies = NULL;
+	task->znext = NULL;
 	
 	unlock(&scheduler.mutex);
-		
+	restore_flags(eflags);
+	
+	timesys_update();
 	return;
 }
 
 
-/* Function removes current task from scheduler queue */
+/*
+ * Function removes current task from scheduler queue. Terminated children
+ * which weren't released by task are removed and destroyed, nobody can wait
+ * for them anymore.
+ */
 void _scheduler_removetask(task_t *task)
 {
+	task_t *zombies, *child;
+	uint_t eflags;
+	
+	eflags = cli_save();
 	lock(&scheduler.mutex);
 	
 	if (task->next == task) {
 		std_printf("KERNEL PANIC: No tasks in the system!\n");
 		unlock(&scheduler.mutex);
+		restore_flags(eflags);
 		return;
 	}
 	
@@ -163,79 +265,176 @@ void _scheduler_removetask(task_t *task)
 	
 	if (task == scheduler.tasks)
 		scheduler.tasks = task->next;
+	if (task->rprev != NULL)
+		scheduler_dequeue(task);
+	scheduler_unhash(task);
+	
+	zombies = task->zombies;
+	task->zombies = NULL;
+
+	unlock(&scheduler.mutex);
+	restore_flags(eflags);
+	
+	while ((child = zombies) != NULL) {
+		zombies = child->znext;
+		_scheduler_removetask(child);
+		destroy_task(child);
+	}
+	return;
+}
+
+
+/*
+ * Function stops current task in given state (sleeping, child waiting or zombie)
+ * and switches to other task. Stopped task isn't queued, it becomes ready when
+ * it is woken up by scheduler_wakeup(). Zombie is put on the list of terminated
+ * children of its parent, where it waits for scheduler_findchild(), and parent
+ * is notified by SIGCHLD. Orphan is passed to task_run (task 1). Listing and
+ * notification are done under the same lock, so parent can't miss the child.
+ */
+void scheduler_block(uint_t state)
+{
+	task_t *task, *parent;
+	uint_t eflags;
+	
+	eflags = cli_save();
+	lock(&scheduler.mutex);
+	task = scheduler.current;
+	task->state = state;
+	
+	if (state == TASK_ZOMBIE) {
+		if ((parent = scheduler_find(task->ppid)) == NULL) {
+			task->ppid = 1;
+			parent = scheduler_find(1);
+		}
+		if (parent != NULL) {
+			task->znext = parent->zombies;
+			parent->zombies = task;
+			parent->sigmap |= (0x80000000 >> SIGCHLD);
+			__scheduler_wakeup(parent);
+		}
+	}
+	unlock(&scheduler.mutex);
+	restore_flags(eflags);
+	
+	reschedule();
+	return;
+}
+
+
+/*
+ * Function makes sleeping or child waiting task ready to run (without locking).
+ * Ready, running, starting and zombie tasks aren't changed.
+ */
+void __scheduler_wakeup(task_t *task)
+{
+	if ((task->state != TASK_SLEEPING) && (task->state != TASK_CHLDWAITING))
+		return;
+	
+	/* Sleeping task isn't queued, even if it is current one going to reschedule */
+	task->state = TASK_READY;
+	scheduler_enqueue(task);
+	return;
+}
 
+
+/* Function makes sleeping or child waiting task ready to run */
+void scheduler_wakeup(task_t *task)
+{
+	uint_t eflags;
+	
+	eflags = cli_save();
+	lock(&scheduler.mutex);
+	__scheduler_wakeup(task);
 	unlock(&scheduler.mutex);
+	restore_flags(eflags);
 	return;
 }
 
 
-/* Scheduler routine (simple Round-Robin) */
+/*
+ * Function returns number of runnable tasks (running or queued), idle threads
+ * excluded. Counting stops at 2, caller only distinguishes idle system and
+ * single runnable task from the others.
+ */
+uint_t scheduler_runnable(void)
+{
+	task_t *task;
+	uint_t eflags, ready, k, n = 0;
+	
+	eflags = cli_save();
+	lock(&scheduler.mutex);
+	task = scheduler.current;
+	if ((task != NULL) && (task->state == TASK_RUNNING) && (task->priority != PRIORITY_IDLE))
+		n++;
+	
+	ready = scheduler.ready & ~(1 << PRIORITY_IDLE);
+	while (ready && (n < 2)) {
+		k = first_bit(ready);
+		n += (scheduler.queues[k]->rnext == scheduler.queues[k]) ? 1 : 2;
+		ready &= ~(1 << k);
+	}
+	unlock(&scheduler.mutex);
+	restore_flags(eflags);
+	return min(n, 2);
+}
+
+
+/*
+ * Scheduler routine. The first task from the highest priority nonempty ready
+ * queue is selected, running task is moved to the end of its queue, so tasks
+ * of equal priority are scheduled in Round-Robin order. Tasks which stopped
+ * running (sleeping, waiting or zombie) aren't queued again.
+ */
 void *scheduler_schedule(uint_t intr)
 {
 	task_t *task, *old;
-	uint_t cnt = 0;
 			
 	scheduler.depth++;
 
+	/* Interrupts stay disabled, device interrupts wake tasks under scheduler lock */
 	lock(&scheduler.mutex);
-			
-	sti();
 	
-	/* Select next task. */
-	if (!scheduler.current)
-		task = scheduler.tasks;
-	else
-		task = scheduler.current;
-
-	/* If no other tasks available return to current task */
-	if (!task) {
+	old = scheduler.current;
+	if ((old != NULL) && (old->state == TASK_RUNNING)) {
+		old->state = TASK_READY;
+		scheduler_enqueue(old);
+	}
+	
+	/* If no tasks are ready return to current task */
+	if (!scheduler.ready) {
 		unlock(&scheduler.mutex);
-		cli();
 		scheduler.depth--;
-		return 0;
+		return old;
 	}
-			
-	for (;;) {
-		if ((task->state != TASK_READY) && (task->state != TASK_STARTING)) {
-			task = task->next;
-
-			/* If no other ready to run tasks available return to current task */
-			if (++cnt > scheduler.ntasks) {
-				unlock(&scheduler.mutex);				
-				cli();
-				scheduler.depth--;
-				return task;
-			}
-			continue;	
-		}
-		
-		if ((scheduler.current) && (scheduler.current->state == TASK_RUNNING))
-			scheduler.current->state = TASK_READY;
+	
+	task = scheduler.queues[first_bit(scheduler.ready)];
+	scheduler_dequeue(task);
+	scheduler.current = task;
+	
+	/* Current task keeps running */
+	if (task == old) {
+		task->state = TASK_RUNNING;
+		unlock(&scheduler.mutex);
+		scheduler.depth--;
+		return task;
+	}
+	
+	if (task->state == TASK_STARTING) {
+		task->state = TASK_RUNNING;
+		unlock(&scheduler.mutex);
+		scheduler.depth--;
 		
-		old = scheduler.current;
-		scheduler.current = task;
+		/* Start task - only start context is available on kernel stack */
+		switch_to(old, task);
+	}
+	else {			
+		task->state = TASK_RUNNING;
+		unlock(&scheduler.mutex);
+		scheduler.depth--;
 		
-		if (task->state == TASK_STARTING) {
-			task->state = TASK_RUNNING;
-			unlock(&scheduler.mutex);
-			
-			cli();			
-			scheduler.depth--;
-			
-			/* Start task - only start context is available on kernel stack */
-			switch_to(old, task);
-		}
-		else {			
-			task->state = TASK_RUNNING;
-			unlock(&scheduler.mutex);
-
-			cli();			
-			scheduler.depth--;
-			
-			/* Change context - full frame is available */
-			switch_context (old, task);
-			break;
-		}		
+		/* Change context - full frame is available */
+		switch_context (old, task);
 	}
 		
 	return task;
@@ -245,6 +444,8 @@ void *scheduler_schedule(uint_t intr)
 /* Function initializes scheduler */
 int scheduler_init(void)
 {
+	uint_t k;
+	
 	/* Initialize architecture dependent structures */
 	archcont_init();
 	
@@ -255,67 +456,112 @@ int scheduler_init(void)
 	scheduler.current = NULL;
 	scheduler.depth = 0;
 	scheduler.lastid = 0;         /* MOD */
+	scheduler.ready = 0;
+	for (k = 0; k < NPRIORITIES; k++)
+		scheduler.queues[k] = NULL;
+	for (k = 0; k < SCHEDULER_HASHSZ; k++)
+		scheduler.hash[k] = NULL;
 
 	return 0;
 }
 
 
-/* Functions returns array of running task pids (PSC) */
+/*
+ * Functions returns array of running task pids (PSC). Identifiers are gathered
+ * in kernel buffer and copied to user buffer after unlocking, user buffer
+ * write may fault.
+ */
 int scheduler_gettasks(uint_t pids[], uint_t length, uint_t *ntasks)
 {
 	task_t *task, *etask;
-	uint_t n = 0;
-
-	/* Lock task queue */
-	lock_cli(&scheduler.mutex);	
-	task = scheduler.tasks;
+	uint_t *buff = NULL, size = 0, n;
 
-	if (!task) {
-		*ntasks = 0;
+	/* Buffer is sized to the number of tasks, it's enlarged when tasks are created in meantime */
+	for (;;) {
+		lock_cli(&scheduler.mutex);
+		if ((task = scheduler.tasks) == NULL) {
+			unlock_sti(&scheduler.mutex);
+			if (buff != NULL)
+				kfree(buff);
+			*ntasks = 0;
+			return -1;
+		}
+		
+		if ((n = min(scheduler.ntasks, length)) <= size)
+			break;
 		unlock_sti(&scheduler.mutex);
-		return -1;
+		
+		if (buff != NULL)
+			kfree(buff);
+		if ((buff = (uint_t *)kmalloc(n * sizeof(uint_t))) == NULL) {
+			*ntasks = 0;
+			return -1;
+		}
+		size = n;
 	}
 			
+	/* All tasks are counted, only size identifiers are stored */
+	n = 0;
 	etask = task;
 	do {
-		pids[n++] = task->id;
+		if (n < size)
+			buff[n] = task->id;
+		n++;
 		task = task->next;
 	} while (task != etask);
+	unlock_sti(&scheduler.mutex);
 	
+	if (buff != NULL) {
+		memcpy(pids, buff, min(n, size) * sizeof(uint_t));
+		kfree(buff);
+	}
 	*ntasks = n;
-	unlock_sti(&scheduler.mutex);
 	return 0;
 }
 
 
-/* Function returns task structure for task given by pid (PSC) */
-int scheduler_gettaskinfo(uint_t pid, task_t *ti, int *err)
+/*
+ * Function returns task structure for task given by pid (PSC). Information
+ * is collected locally and copied to user buffer after unlocking.
+ */
+int scheduler_gettaskinfo(uint_t pid, taskinfo_t *ti, int *err)
 {
-	task_t *task, *etask;
+	taskinfo_t info;
+	task_t *task;
 
-	/* Lock task queue */
 	lock_cli(&scheduler.mutex);	
-	task = scheduler.tasks;
-
-	if (!task) {
-		*err = -1;
+	if ((task = scheduler_find(pid)) == NULL) {
 		unlock_sti(&scheduler.mutex);
-		return -1;
+		*err = -1;
+		return 0;
 	}
-			
-	etask = task;
-	do {
-		if (task->id == pid) {
-			memcpy(ti, task, TASK_INFO_SIZE);         /* copy only first fields */
-			*err = 0;
-			unlock_sti(&scheduler.mutex);
-			return 0;
-		}
-		task = task->next;
-	} while (task != etask);
 	
-	*err = -1;
+	info.id = task->id;
+	info.ppid = task->ppid;
+	info.priority = task->priority;
+	info.cpu = task->cpu;
+	info.state = task->state;
+	info.type = task->type;
+	memcpy(info.name, task->name, TASK_INFO_NAMESZ - 1);
+	info.name[TASK_INFO_NAMESZ - 1] = 0;
+	
+	/*
+	 * Memory usage is read from pmap counters and memory map. Map is read under
+	 * the lock so task can't be released in meantime, map_kmem() touches only
+	 * kernel structures and can't fault.
+	 */
+	info.resident = 0;
+	info.ptables = 0;
+	info.kmem = sizeof(task_t) + PAGE_SIZE;
+	if (task->vm_map != NULL) {
+		info.resident = task->vm_map->pmap->npages * PAGE_SIZE;
+		info.ptables = task->vm_map->pmap->ntables * PAGE_SIZE;
+		info.kmem += map_kmem(task->vm_map);
+	}
 	unlock_sti(&scheduler.mutex);
+	
+	memcpy(ti, &info, sizeof(taskinfo_t));
+	*err = 0;
 	return 0;
 }
 
@@ -323,30 +569,20 @@ int scheduler_gettaskinfo(uint_t pid, task_t *ti, int *err)
 /* Function sends signal to task given by pid */
 int raise(uint_t pid, uint_t sig)
 {
-	task_t *task, *etask;
+	task_t *task;
 	
-	/* Lock task queue */
 	lock_cli(&scheduler.mutex);	
-	task = scheduler.tasks;
-
-	if (!task) {
+	if ((task = scheduler_find(pid)) == NULL) {
 		unlock_sti(&scheduler.mutex);
 		return -1;
 	}
-			
-	etask = task;
-	do {
-		if (task->id == pid) {
-			task->sigmap |= (0x80000000 >> sig);
-			task->state = TASK_READY;
-			unlock_sti(&scheduler.mutex);
-			return 0;
-		}
-		task = task->next;
-	} while (task != etask);
 	
+	task->sigmap |= (0x80000000 >> sig);
+	__scheduler_wakeup(task);
 	unlock_sti(&scheduler.mutex);
-	return -1;
+	
+	timesys_update();
+	return 0;
 }
 
 
@@ -358,29 +594,58 @@ void psc_raise(uint_t pid, uint_t sig, int *err)
 }
 
 
-/* Function finds zombie child for task given by pid */
-task_t *scheduler_findchild(uint_t pid)
+/* Function changes priority of task given by pid */
+int scheduler_setpriority(uint_t pid, uint_t priority)
 {
-	task_t *task, *etask;
+	task_t *task;
 	
-	/* Lock task queue */
-	lock(&scheduler.mutex);	
-	task = scheduler.tasks;
-
-	if (!task) {
+	if (priority >= NPRIORITIES)
+		return -1;
+	
+	lock_cli(&scheduler.mutex);
+	if ((task = scheduler_find(pid)) == NULL) {
 		unlock_sti(&scheduler.mutex);
-		return NULL;
+		return -1;
 	}
-				
-	etask = task;
-	do {
-		if ((task->ppid == pid) && (task->state == TASK_ZOMBIE)) {
-			unlock(&scheduler.mutex);
-			return task;
-		}
-		task = task->next;
-	} while (task != etask);
 	
+	/* Queued task is moved to the queue of new priority */
+	if (task->rprev != NULL) {
+		scheduler_dequeue(task);
+		task->priority = priority;
+		scheduler_enqueue(task);
+	}
+	else
+		task->priority = priority;
+	
+	unlock_sti(&scheduler.mutex);
+	return 0;
+}
+
+
+/* scheduler_setpriority() (PSC) */
+void psc_setpriority(uint_t pid, uint_t priority, int *err)
+{
+	*err = scheduler_setpriority(pid, priority);
+	return;
+}
+
+
+/*
+ * Function finds zombie child for task given by pid and takes it from the
+ * list of terminated children
+ */
+task_t *scheduler_findchild(uint_t pid)
+{
+	task_t *task, *child = NULL;
+	uint_t eflags;
+	
+	eflags = cli_save();
+	lock(&scheduler.mutex);
+	if (((task = scheduler_find(pid)) != NULL) && ((child = task->zombies) != NULL)) {
+		task->zombies = child->znext;
+		child->znext = NULL;
+	}
 	unlock(&scheduler.mutex);
-	return NULL;
+	restore_flags(eflags);
+	return child;
 }
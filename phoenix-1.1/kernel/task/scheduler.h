@@ -49,10 +49,9 @@ extern task_t *scheduler_getcurrent(void);
 
 /*
  * Function returns scheduler depth. When scheduler is called depth is increased,
- * when leaved depth is decreased. This functions is very important because
- * during scheduling function execution interrupts are unmasked. In some cases,
- * when scheduling duration time is to long, interrupts are cascaded
- * and scheduler depth informs about this fact and prevents deadlock.
+ * when leaved depth is decreased. Scheduling function runs with interrupts
+ * masked, because device interrupts wake tasks under scheduler lock. Depth
+ * still prevents timer handler from entering scheduler recursively.
  */
 extern uint_t scheduler_depth(void);
 
@@ -73,7 +72,23 @@ extern void scheduler_addtask(task_t *task);
 extern void _scheduler_removetask(task_t *task);
 
 
-/* Scheduler routine (simple Round-Robin) */
+/* Function stops current task in given state and switches to other task */
+extern void scheduler_block(uint_t state);
+
+
+/* Function returns number of runnable tasks without idle threads, counting stops at 2 */
+extern uint_t scheduler_runnable(void);
+
+
+/* Function makes sleeping or child waiting task ready to run (without locking) */
+extern void __scheduler_wakeup(task_t *task);
+
+
+/* Function makes sleeping or child waiting task ready to run */
+extern void scheduler_wakeup(task_t *task);
+
+
+/* Scheduler routine (priority queues, Round-Robin within priority) */
 extern void *scheduler_schedule(uint_t intr);
 
 
@@ -86,7 +101,7 @@ extern int scheduler_gettasks(uint_t pids[], uint_t length, uint_t *ntasks);
 
 
 /* Function returns task structure for task given by pid (PSC) */
-extern int scheduler_gettaskinfo(uint_t pid, task_t *ti, int *err);
+extern int scheduler_gettaskinfo(uint_t pid, taskinfo_t *ti, int *err);
 
 
 /* Function sends signal to task given by pid */
@@ -97,7 +112,15 @@ extern int raise(uint_t pid, uint_t sig);
 extern void psc_raise(uint_t pid, uint_t sig, int *err);
 
 
-/* Function finds zombie child for task given by pid */
+/* Function changes priority of task given by pid */
+extern int scheduler_setpriority(uint_t pid, uint_t priority);
+
+
+/* scheduler_setpriority() (PSC) */
+extern void psc_setpriority(uint_t pid, uint_t priority, int *err);
+
+
+/* Function finds zombie child for task given by pid and takes it from the list of terminated children */
 extern task_t *scheduler_findchild(uint_t pid);
 
 
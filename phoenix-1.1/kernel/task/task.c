@@ -28,11 +28,31 @@
 #include <init/std.h>
 #include <vm/vm.h>
 #include <vm/kmalloc.h>
+#include <vm/cache.h>
 #include <task/task.h>
+#include <task/exec.h>
 #include <task/scheduler.h>
 #include <comm/signals.h>
 
 
+/* Caches of task structures and one page kernel stacks */
+cache_t *task_cache;
+cache_t *kstack_cache;
+
+
+/* Function initializes task manager caches */
+int task_init(void)
+{
+	if ((task_cache = cache_create(sizeof(task_t), 32, NULL, NULL)) == NULL)
+		return -1;
+	
+	if ((kstack_cache = cache_create(PAGE_SIZE, 16, NULL, NULL)) == NULL)
+		return -1;
+	
+	return 0;
+}
+
+
 /* Function creates kernel thread. When stack is NULL new page is allocated */
 task_t *create_kernel_thread(char *name, void *start, void *stack, uchar_t type)
 {
@@ -40,7 +60,7 @@ task_t *create_kernel_thread(char *name, void *start, void *stack, uchar_t type)
 	void *kstack;
 	unsigned int l;
 		
-	if ((task = (task_t *)kmalloc(sizeof(task_t))) == NULL)
+	if ((task = (task_t *)cache_alloc(task_cache)) == NULL)
 		return NULL;
 	
 	l = min(std_strlen(name), TASK_NAME_SIZE);	
@@ -48,14 +68,15 @@ task_t *create_kernel_thread(char *name, void *start, void *stack, uchar_t type)
 		
 	task->type = KERNEL_TASK;
 	task->ppid = 0;
-	task->priority = 0;
+	task->priority = PRIORITY_DEFAULT;
 	task->sigmap = 0;
 	for (l = 0; l < sizeof(task->sigmap); l++)
 		task->sighandlers[l] = 0;
 	
 	/* Allocate stack for new task */
 	if (stack == NULL) {
-		if ((kstack = (void *)kernel_pages_alloc(1)) == NULL) {
+		if ((kstack = cache_alloc(kstack_cache)) == NULL) {
+			cache_free(task_cache, task);
 			return NULL;
 		}
 	}
@@ -82,12 +103,11 @@ task_t *create_task(char *name, vm_map_t *map, void *start, uint_t priority)
 {
 	task_t *task, *current;
 	void *kstack;
-	page_t *ustack_area;
 	vm_seg_t *sseg;
 	uint_t l;
 		
 	/* Allocate new task structure */
-	if ((task = (task_t *)kmalloc(sizeof(task_t))) == NULL)
+	if ((task = (task_t *)cache_alloc(task_cache)) == NULL)
 		return NULL;
 	
 	/* Initialize important fields */	
@@ -114,15 +134,14 @@ task_t *create_task(char *name, vm_map_t *map, void *start, uint_t priority)
 	task->type = USER_TASK;
 	
 	/* Allocate one page kernel stack for new task */
-	if ((kstack = (void *)kernel_pages_alloc(1)) == NULL)
-		return NULL;
-
-	/* Allocate four page user stack for new task */
-	if ((ustack_area = (void *)area_alloc(STACK_SIZE, REG_MEM)) == NULL)
+	if ((kstack = cache_alloc(kstack_cache)) == NULL) {
+		cache_free(task_cache, task);
 		return NULL;
+	}
 
-	sseg = seg_create(ustack_area,
-	                  (void *)USER_STACK_TOP - STACK_SIZE * PAGE_SIZE,
+	/* Create user stack segment, stack pages are allocated when stack grows */
+	sseg = seg_create(NULL,
+	                  (void *)USER_STACK_TOP - STACK_SIZE * PAGE_SIZE, STACK_SIZE * PAGE_SIZE,
 	                  PGHD_PRESENT | PGHD_WRITE | PGHD_READ | PGHD_NOEXEC | PGHD_USER);
 	
 	if (!sseg)
@@ -156,22 +175,32 @@ void exit_task(int err)
 	if (task->type == KERNEL_TASK)
 		return;
 
-	/* Release all task segments and memory map */
-	release_segs(task->vm_map);
+	/* Release all task segments and close executable file */
+	exec_release(task->vm_map);
 	task->exit = err;
 	
 	/*
-	 * Send exit notification to parent task. If taks is orphan send notification
-	 * to task_run, which must exist.
+	 * Exit notification is sent to parent task by scheduler. If taks is orphan
+	 * notification is sent to task_run, which must exist.
 	 */
-	if (raise(task->ppid, SIGCHLD) < 0) {
-		task->ppid = 1;
-		raise(task->ppid, SIGCHLD);
-	}
+	scheduler_block(TASK_ZOMBIE);
 	
-	task->state = TASK_ZOMBIE;
-	reschedule();
+	return;
+}
+
+
+/*
+ * Function releases structures of the terminated task - kernel stack, memory
+ * map and task structure. Task must be removed from scheduler queue before.
+ */
+void destroy_task(task_t *task)
+{
+	cache_free(kstack_cache, archcont_getkstack(&task->ac));
+	
+	if (task->type == USER_TASK)
+		map_free(task->vm_map);
 	
+	cache_free(task_cache, task);
 	return;
 }
 
@@ -193,11 +222,8 @@ uint_t wait(int *err)
 		return 0;
 	
 	task->chldpid = 0;
-	while (!task->chldpid) {
-	
-		task->state = TASK_CHLDWAITING;	
-		reschedule();		
-	}
+	while (!task->chldpid)
+		scheduler_block(TASK_CHLDWAITING);
 
 	*err = task->chldexit;	
 	return task->chldpid;
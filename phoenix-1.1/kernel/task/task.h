@@ -34,7 +34,7 @@
 
 
 #define TASK_NAME_SIZE   36
-#define TASK_INFO_SIZE   TASK_NAME_SIZE + 20
+#define TASK_INFO_NAMESZ 32
 
 
 /* Taks types */
@@ -51,8 +51,14 @@
 #define TASK_ZOMBIE       5  /* taks exits but parent task isn't notified about this fact yet */
 
 
-/* Initial stack size in pages - on IA32 16KB */
-#define STACK_SIZE  4
+/* Scheduling priorities, 0 is the highest one. Idle threads have the lowest priority */
+#define NPRIORITIES       8
+#define PRIORITY_DEFAULT  4
+#define PRIORITY_IDLE     (NPRIORITIES - 1)
+
+
+/* Maximal user stack size in pages - on IA32 1MB. Pages are allocated on demand */
+#define STACK_SIZE  256
 
 
 /* Task stucture */
@@ -74,9 +80,33 @@ typedef struct task {
 	int exit;                    /* exit code */
 	volatile int chldexit;       /* child exit code, used by wait() function */
 	volatile uint_t chldpid;     /* stopped child pid, used by wait() function */
+	struct task *rnext;          /* next task in ready queue of its priority */
+	struct task *rprev;          /* previous task in ready queue, NULL when task isn't queued */
+	struct task *hnext;          /* next task in identifier hash chain */
+	struct task *zombies;        /* terminated children not released yet */
+	struct task *znext;          /* next terminated child of parent task */
 } task_t;
 
 
+/* Task information returned to user tasks, memory usage is given in bytes */
+typedef struct _taskinfo_t {
+	uint_t id;
+	uint_t ppid;
+	uint_t priority;
+	uint_t cpu;
+	uint_t state;
+	uint_t type;
+	char name[TASK_INFO_NAMESZ];
+	uint_t resident;             /* user pages mapped by task, shared pages included */
+	uint_t ptables;              /* page tables of task address space */
+	uint_t kmem;                 /* task descriptor, kernel stack and memory map structures */
+} taskinfo_t;
+
+
+/* Function initializes task manager caches */
+extern int task_init(void);
+
+
 /* Function creates kernel thread. When stack is NULL new page is allocated */
 extern task_t *create_kernel_thread(char *name, void *start, void *stack, uchar_t type);
 
@@ -100,6 +130,13 @@ extern task_t *create_task(char *name, vm_map_t *map, void *start, uint_t priori
 extern void exit_task(int err);
 
 
+/*
+ * Function releases structures of the terminated task - kernel stack, memory
+ * map and task structure. Task must be removed from scheduler queue before.
+ */
+extern void destroy_task(task_t *task);
+
+
 /* exit (PSC) */
 extern void psc_exit(int err);
 
@@ -35,58 +35,181 @@
 #include <task/scheduler.h>
 
 
-/* Structure defining kernel timer. Used by all kinds of sleep functions */
+/* Number of timer wheel slots, must be power of 2 */
+#define TIMESYS_WHEELSZ  256
+
+
+/* Timer flags */
+#define TIMER_WHEEL  0x01  /* timer is in the wheel */
+#define TIMER_WATCH  0x02  /* timer is on the list of variable watches */
+
+
+/*
+ * Structure defining kernel timer. Used by all kinds of sleep functions. Timer
+ * with timeout is kept in wheel slot given by its expiry tick, timer monitoring
+ * variable is kept on the list of watches until wakeup_on() is called for it.
+ */
 typedef struct timer {
-	volatile uint_t delay; /* delay time in milliseconds */
-	struct timer *next;    /* next timer on the list */
-	struct timer *prev;    /* previous timer on the list */
+	uint_t flags;          /* lists containing timer */
+	uint_t expire;         /* absolute expiry tick */
+	volatile uint_t done;  /* timer expired or monitored variable changed */
+	struct timer *next;    /* next timer in wheel slot */
+	struct timer *prev;    /* previous timer in wheel slot */
+	struct timer *wnext;   /* next variable watch */
+	struct timer *wprev;   /* previous variable watch */
 	uint_t *var;           /* monitored variable */
 	uint_t val;            /* awaiting value */
 	task_t *task;          /* awaiting task */
 } timer_t;
 
 
+/*
+ * Timer subsystem. Slot k of the wheel holds timers expiring at ticks equal
+ * to k modulo TIMESYS_WHEELSZ sorted by expiry tick, so each tick visits
+ * only expired timers. When at most one task is runnable periodic ticks are
+ * stopped and hardware timer interrupts once at the next timer expiry.
+ */
 struct {
 	uint_t slice;     /* hardware timer tic */
 	uint_t tics;      /* number of tics from the system start*/
-	timer_t *tl;      /* timer list */
+	uint_t oneshot;   /* one-shot interrupt is pending, 0 in periodic mode */
+	uint_t deadline;  /* tic of pending one-shot interrupt */
+	uint_t skipped;   /* tics not counted yet due to interrupt cascading */
+	timer_t *wheel[TIMESYS_WHEELSZ];  /* timer wheel */
+	timer_t *watches; /* timers monitoring variables */
 	mutex_t mutex;    /* access mutex */
 } timesys;
 
 
+/* Function advances system time by n tics and wakes up tasks with expired timers */
+static void timesys_advance(uint_t n)
+{
+	timer_t **slot, *t;
+	
+	while (n--) {
+		timesys.tics++;
+		
+		slot = &timesys.wheel[timesys.tics & (TIMESYS_WHEELSZ - 1)];
+		while (((t = *slot) != NULL) && ((int)(t->expire - timesys.tics) <= 0)) {
+			if ((*slot = t->next) != NULL)
+				t->next->prev = NULL;
+			t->flags &= ~TIMER_WHEEL;
+			t->done = 1;
+			scheduler_wakeup(t->task);
+		}
+	}
+	return;
+}
+
+
+/*
+ * Function selects timer mode. When system is idle or only one task is
+ * runnable timer interrupts once at the next timer expiry (limited by hardware
+ * counter), otherwise it interrupts every tic.
+ */
+static void timesys_program(void)
+{
+	timer_t *t;
+	uint_t n = 1, max;
+	
+	if (scheduler_runnable() <= 1) {
+		max = min(timedev_maxslices(), TIMESYS_WHEELSZ);
+		for (n = 1; n < max; n++) {
+			t = timesys.wheel[(timesys.tics + n) & (TIMESYS_WHEELSZ - 1)];
+			if ((t != NULL) && (t->expire == timesys.tics + n))
+				break;
+		}
+	}
+	
+	/* Timer is reprogrammed only when new deadline is earlier than pending one */
+	if (n > 1) {
+		if (!timesys.oneshot || ((int)(timesys.tics + n - timesys.deadline) < 0)) {
+			timedev_oneshot(n);
+			timesys.deadline = timesys.tics + n;
+		}
+		timesys.oneshot = 1;
+	}
+	else if (timesys.oneshot) {
+		timedev_periodic();
+		timesys.oneshot = 0;
+	}
+	return;
+}
+
+
+/*
+ * Function restores periodic tics in one-shot mode when more than one task
+ * is runnable, so newly woken task doesn't wait for one-shot interrupt
+ * (without locking)
+ */
+static void __timesys_update(void)
+{
+	if (timesys.oneshot && (scheduler_runnable() > 1)) {
+		timesys_advance(timedev_elapsed());
+		timedev_periodic();
+		timesys.oneshot = 0;
+	}
+	return;
+}
+
+
+/* Function restores periodic tics when more than one task became runnable */
+void timesys_update(void)
+{
+	uint_t eflags;
+	
+	eflags = cli_save();
+	lock(&timesys.mutex);
+	__timesys_update();
+	unlock(&timesys.mutex);
+	restore_flags(eflags);
+	return;
+}
+
+
+/*
+ * Timer interrupt handler, called also by reschedule() with RESCHED_INTR.
+ * Rescheduling doesn't advance time in periodic mode, in one-shot mode tics
+ * elapsed so far are counted and timer mode is selected again.
+ */
 void *time_intr_handler(uint_t intr)
 {
-	volatile timer_t *t;
+	uint_t n;
 	
 	/* Inform interrupt controler about interrupt handling */
-	__intr_end(intr);
+	if (intr != RESCHED_INTR)
+		__intr_end(intr);
 	
 	/* Interrupts are still blocked... */
 	
-	/* Interrupt cascading prevention */
-	if (scheduler_depth() >= 1)
+	/* Interrupt cascading prevention, stopped timer is restarted */
+	if (scheduler_depth() >= 1) {
+		lock(&timesys.mutex);
+		if ((intr != RESCHED_INTR) && timesys.oneshot) {
+			timesys.skipped += timedev_elapsed();
+			timedev_periodic();
+			timesys.oneshot = 0;
+		}
+		unlock(&timesys.mutex);
 		return 0;
+	}
 	
-	lock(&timesys.mutex);		
-	/* scheduler_lock(); */
-	timesys.tics++;
+	/*
+	 * In one-shot mode elapsed tics are read from hardware timer, so interrupt
+	 * pending before timer was reprogrammed doesn't count one-shot period
+	 */
+	lock(&timesys.mutex);
+	if (timesys.oneshot)
+		n = timedev_elapsed();
+	else
+		n = (intr != RESCHED_INTR);
 	
-	/* Browse timer list an wake up tasks (MOD) */
-	for (t = timesys.tl; t != NULL; t = t->next) {
-		if (t->var != NULL) {		
-			if (*t->var != t->val) {
-				t->task->state = TASK_READY;
-				t->delay = 0;
-			}			
-
-			if (!t->delay) continue;
-		}
-					
-		if (t->delay > 0) t->delay--;
-		if (!t->delay) t->task->state = TASK_READY;	
-	}
+	n += timesys.skipped;
+	timesys.skipped = 0;
+	timesys_advance(n);
 	
-	/* scheduler_unlock(); */
+	if ((intr != RESCHED_INTR) || timesys.oneshot)
+		timesys_program();
 	unlock(&timesys.mutex);
 	
 	return scheduler_schedule(intr);
@@ -96,9 +219,16 @@ void *time_intr_handler(uint_t intr)
 /* Function initializes timer subsystem */
 int timesys_init(uint_t slice)
 {
+	uint_t k;
+	
 	timesys.slice = slice;
 	timesys.tics = 0;
-	timesys.tl = NULL;
+	timesys.oneshot = 0;
+	timesys.deadline = 0;
+	timesys.skipped = 0;
+	for (k = 0; k < TIMESYS_WHEELSZ; k++)
+		timesys.wheel[k] = NULL;
+	timesys.watches = NULL;
 	unlock(&timesys.mutex);
 	timedev_init(slice);
 	
@@ -108,29 +238,123 @@ int timesys_init(uint_t slice)
 }
 
 
-/* Macro adds timer to list */
-#define timesys_add(t) {         \
-	if (timesys.tl == NULL) {      \
-		timesys.tl = &t;             \
-		t.next = NULL;               \
-		t.prev = NULL;               \
-	}                              \
-	else {                         \
-		t.next = timesys.tl;         \
-		timesys.tl->prev = &t;       \
-		t.prev = NULL;               \
-		timesys.tl = &t;             \
-	}                              \
+/*
+ * Function initializes timer for current task and adds it to the wheel (when
+ * timeout is used) and to the list of watches (when var isn't NULL). Variable
+ * watch with zero delay has no timeout.
+ */
+static void timesys_add(timer_t *t, uint_t delay, uint_t *var, uint_t val)
+{
+	timer_t **slot, *p;
+	uint_t ticks;
+	
+	lock_cli(&timesys.mutex);
+	t->flags = 0;
+	t->done = 0;
+	t->task = __scheduler_getcurrent();
+	t->var = var;
+	t->val = val;
+	
+	if ((var == NULL) || delay) {
+		if ((ticks = delay * 1000 / timesys.slice) == 0)
+			ticks = 1;
+		t->expire = timesys.tics + ticks;
+		
+		slot = &timesys.wheel[t->expire & (TIMESYS_WHEELSZ - 1)];
+		for (p = NULL; (*slot != NULL) && ((int)((*slot)->expire - t->expire) <= 0); slot = &(*slot)->next)
+			p = *slot;
+		
+		t->prev = p;
+		t->next = *slot;
+		if (*slot != NULL)
+			(*slot)->prev = t;
+		*slot = t;
+		t->flags |= TIMER_WHEEL;
+	}
+	
+	if (var != NULL) {
+		if (*var != val)
+			t->done = 1;
+		
+		t->wprev = NULL;
+		if ((t->wnext = timesys.watches) != NULL)
+			timesys.watches->wprev = t;
+		timesys.watches = t;
+		t->flags |= TIMER_WATCH;
+	}
+	unlock_sti(&timesys.mutex);
+	return;
+}
+
+
+/* Function removes timer from the wheel and from the list of watches */
+static void timesys_remove(timer_t *t)
+{
+	lock_cli(&timesys.mutex);
+	if (t->flags & TIMER_WHEEL) {
+		if (t->prev != NULL)
+			t->prev->next = t->next;
+		else
+			timesys.wheel[t->expire & (TIMESYS_WHEELSZ - 1)] = t->next;
+		if (t->next != NULL)
+			t->next->prev = t->prev;
+	}
+	
+	if (t->flags & TIMER_WATCH) {
+		if (t->wprev != NULL)
+			t->wprev->wnext = t->wnext;
+		else
+			timesys.watches = t->wnext;
+		if (t->wnext != NULL)
+			t->wnext->wprev = t->wprev;
+	}
+	t->flags = 0;
+	unlock_sti(&timesys.mutex);
+	return;
+}
+
+
+/*
+ * Function puts current task to sleep until timer expires. When intr is set
+ * sleep ends also after other wakeup (e.g. signal). Interrupts are disabled
+ * between checking timer and changing task state, so wakeup isn't lost.
+ */
+static void timesys_sleep(timer_t *t, uint_t intr)
+{
+	uint_t eflags;
+	
+	eflags = cli_save();
+	while (!t->done) {
+		scheduler_block(TASK_SLEEPING);
+		if (intr)
+			break;
+	}
+	restore_flags(eflags);
+	return;
 }
 
 
-/* Macro removes timer from list */
-#define timesys_remove(t) {                                            \
-	lock_cli(&timesys.mutex);                                            \
-	if (t.prev != NULL) t.prev->next = t.next; else timesys.tl = t.next; \
-	if (t.next != NULL) t.next->prev = t.prev;                           \
-	if ((t.prev == NULL) && (t.next == NULL)) timesys.tl = NULL;         \
-	unlock_sti(&timesys.mutex);                                          \
+/*
+ * Function wakes up tasks waiting until value of variable var changes. It
+ * should be called after var is modified.
+ */
+void wakeup_on(uint_t *var)
+{
+	timer_t *t;
+	uint_t eflags;
+	
+	eflags = cli_save();
+	lock(&timesys.mutex);
+	for (t = timesys.watches; t != NULL; t = t->wnext) {
+		if ((t->var == var) && (*var != t->val) && !t->done) {
+			t->done = 1;
+			scheduler_wakeup(t->task);
+		}
+	}
+	__timesys_update();
+	unlock(&timesys.mutex);
+	restore_flags(eflags);
+	return;
 }
 
 
@@ -141,26 +365,10 @@ int timesys_init(uint_t slice)
 void sleep_unintr(uint_t delay)
 {
 	timer_t t;
-			
-	lock_cli(&timesys.mutex);	
-	//scheduler_lock();
-	t.delay = delay * 1000 / timesys.slice;
-	t.task = __scheduler_getcurrent();
-	
-	t.var = NULL;
-	timesys_add(t);
-		
-	//scheduler_unlock();
-	unlock_sti(&timesys.mutex);
 	
-	for (;;) {
-		t.task->state = TASK_SLEEPING;
-		reschedule();
-		
-		if (!t.delay) break;
-	}
-	
-	timesys_remove(t);
+	timesys_add(&t, delay, NULL, 0);
+	timesys_sleep(&t, 0);
+	timesys_remove(&t);
 	return;
 }
 
@@ -173,27 +381,10 @@ void sleep_unintr(uint_t delay)
 void sleep_on_unintr(uint_t delay, uint_t *var, uint_t val)
 {
 	timer_t t;
-			
-	lock_cli(&timesys.mutex);	
-	//scheduler_lock();
 	
-	t.delay = delay * 1000 / timesys.slice;
-	t.task = __scheduler_getcurrent();	
-	t.var = var;
-	t.val = val;
-	timesys_add(t);			
-
-	//scheduler_unlock();
-	unlock_sti(&timesys.mutex);
-
-	for (;;) {
-		t.task->state = TASK_SLEEPING;
-		reschedule();
-		if (!t.delay) break;
-	}
-	
-	timesys_remove(t);
-
+	timesys_add(&t, delay, var, val);
+	timesys_sleep(&t, 0);
+	timesys_remove(&t);
 	return;
 }
 
@@ -205,22 +396,9 @@ void sleep_on_unintr(uint_t delay, uint_t *var, uint_t val)
 void sleep_on(uint_t delay, uint_t *var, uint_t val)
 {
 	timer_t t;
-			
-	lock_cli(&timesys.mutex);	
-	//scheduler_lock();
 	
-	t.delay = delay * 1000 / timesys.slice;
-	t.task = __scheduler_getcurrent();	
-	t.var = var;
-	t.val = val;
-	timesys_add(t);			
-
-	//scheduler_unlock();
-	unlock_sti(&timesys.mutex);
-
-	t.task->state = TASK_SLEEPING;
-	reschedule();	
-	timesys_remove(t);
-
+	timesys_add(&t, delay, var, val);
+	timesys_sleep(&t, 1);
+	timesys_remove(&t);
 	return;
 }
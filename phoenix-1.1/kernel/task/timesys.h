@@ -35,6 +35,13 @@
 extern int timesys_init(uint_t slice);
 
 
+/*
+ * Function restores periodic tics when more than one task became runnable
+ * while timer was in one-shot mode. It's called after task wakeup.
+ */
+extern void timesys_update(void);
+
+
 /*
  * Function suspends task execution for time given by delay (in miliseconds).
  * Task sleeping can't be interrupted by signals.
@@ -57,4 +64,11 @@ extern void sleep_on_unintr(uint_t delay, uint_t *var, uint_t val);
 extern void sleep_on(uint_t delay, uint_t *var, uint_t val);
 
 
+/*
+ * Function wakes up tasks sleeping on variable var whose value has changed.
+ * Code modifying monitored variable calls it, timer doesn't poll variables.
+ */
+extern void wakeup_on(uint_t *var);
+
+
 #endif
@@ -0,0 +1,118 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Object caches
+ *
+ * Copyright 2001 Pawel Pisarczyk
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * Phoenix-RTOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Phoenix-RTOS kernel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Phoenix-RTOS kernel; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <hal/current/types.h>
+#include <hal/current/defs.h>
+#include <hal/current/locore.h>
+#include <init/std.h>
+#include <vm/vm.h>
+#include <vm/kmalloc.h>
+#include <vm/cache.h>
+
+
+/* Function allocates memory for new object */
+static inline void *cache_getmem(cache_t *cache)
+{
+	if (cache->size < PAGE_SIZE)
+		return kmalloc(cache->size);
+	return kernel_pages_alloc((cache->size + PAGE_SIZE - 1) / PAGE_SIZE);
+}
+
+
+/* Function releases object memory */
+static inline void cache_putmem(cache_t *cache, void *obj)
+{
+	if (cache->size < PAGE_SIZE)
+		kfree(obj);
+	else
+		kernel_pages_free(obj);
+	return;
+}
+
+
+/* Function creates object cache. Constructor and destructor are optional */
+cache_t *cache_create(uint_t size, uint_t limit, void (*ctor)(void *), void (*dtor)(void *))
+{
+	cache_t *cache;
+	
+	if ((cache = (cache_t *)kmalloc(sizeof(cache_t))) == NULL)
+		return NULL;
+	
+	if ((cache->objs = (void **)kmalloc(limit * sizeof(void *))) == NULL) {
+		kfree(cache);
+		return NULL;
+	}
+	
+	unlock(&cache->mutex);
+	cache->size = size;
+	cache->limit = limit;
+	cache->nfree = 0;
+	cache->ctor = ctor;
+	cache->dtor = dtor;
+	return cache;
+}
+
+
+/* Function allocates constructed object from the cache */
+void *cache_alloc(cache_t *cache)
+{
+	void *obj;
+	
+	lock(&cache->mutex);
+	if (cache->nfree) {
+		obj = cache->objs[--cache->nfree];
+		unlock(&cache->mutex);
+		return obj;
+	}
+	unlock(&cache->mutex);
+	
+	/* Cache is empty - create new object */
+	if ((obj = cache_getmem(cache)) == NULL)
+		return NULL;
+	
+	if (cache->ctor != NULL)
+		cache->ctor(obj);
+	return obj;
+}
+
+
+/* Function returns object to the cache. Object must be in constructed state */
+void cache_free(cache_t *cache, void *obj)
+{
+	lock(&cache->mutex);
+	if (cache->nfree < cache->limit) {
+		cache->objs[cache->nfree++] = obj;
+		unlock(&cache->mutex);
+		return;
+	}
+	unlock(&cache->mutex);
+	
+	/* Cache is full - destroy object */
+	if (cache->dtor != NULL)
+		cache->dtor(obj);
+	cache_putmem(cache, obj);
+	return;
+}
@@ -0,0 +1,61 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Object caches
+ *
+ * Copyright 2001 Pawel Pisarczyk
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * Phoenix-RTOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Phoenix-RTOS kernel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Phoenix-RTOS kernel; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <hal/current/types.h>
+
+
+/*
+ * Object cache. Cache keeps released objects in constructed state, so they
+ * can be reused without calling constructor again. Objects smaller than page
+ * are allocated by kmalloc(), larger ones directly from the page allocator.
+ */
+typedef struct _cache_t {
+	mutex_t mutex;             /* access mutex */
+	uint_t size;               /* object size */
+	uint_t limit;              /* maximum number of kept objects */
+	uint_t nfree;              /* number of kept objects */
+	void **objs;               /* stack of kept objects */
+	void (*ctor)(void *obj);   /* object constructor */
+	void (*dtor)(void *obj);   /* object destructor */
+} cache_t;
+
+
+/* Function creates object cache. Constructor and destructor are optional */
+extern cache_t *cache_create(uint_t size, uint_t limit, void (*ctor)(void *), void (*dtor)(void *));
+
+
+/* Function allocates constructed object from the cache */
+extern void *cache_alloc(cache_t *cache);
+
+
+/* Function returns object to the cache. Object must be in constructed state */
+extern void cache_free(cache_t *cache, void *obj);
+
+
+#endif
@@ -45,9 +45,11 @@ typedef struct bucket_header {
  * Header of bucket area.
  */
 typedef struct area_header {
-	struct area_header  *next;         /* pointer to the nex area in chain */
+	struct area_header  *next;         /* next area on the partial list */
+	struct area_header  *prev;         /* previous area on the partial list */
 	bucket_header_t     *first_free;   /* first free bucket */
 	uint_t              nbuckets;      /* number of buckets in rea */
+	uint_t              nused;         /* number of allocated buckets */
 	uint_t              size;          /* area size in bytes */
 	uint_t              idx;           /* sizes[] table index */
 } area_header_t;
@@ -57,7 +59,7 @@ typedef struct area_header {
  * sizes[] item - size descriptor
  */
 typedef struct kmalloc_size_descriptor {
-	area_header_t  *first_area;      /* first area on the list */
+	area_header_t  *partial;         /* list of areas with free buckets */
 	uint_t         nbuckets;         /* number of all created buckets */
 	uint_t         alloc_buckets;    /* allocated buckets in all areas */
 	uint_t         bucket_size;      /* bucket size */
@@ -78,12 +80,54 @@ kmalloc_size_descriptor_t sizes[] = {
 	{ NULL, 0, 0, 0    }};
 
 
+/* Largest bucket size */
+#define KMALLOC_MAXSIZE  2040
+
+
+/*
+ * sizes[] index used in headers of large allocations. Larger blocks are
+ * allocated directly as whole pages with area and bucket headers at the
+ * beginning, so kfree() can find allocation size.
+ */
+#define KMALLOC_LARGE    0xffffffff
+
+
+/*
+ * Size to sizes[] index lookup table. Bucket sizes are multiples of 4, so
+ * table is indexed by (size + 3) / 4. It's filled by kmalloc_init().
+ */
+uchar_t kmalloc_idx[KMALLOC_MAXSIZE / 4 + 1];
+
+
 uint_t kmalloc_npages = 0;
 
-/* kmalloc() access mutex */
+/* Number of pages held by all kmalloc areas */
+uint_t kmalloc_pages = 0;
+
+/* kmalloc() access mutex, always taken with interrupts disabled */
 mutex_t kmalloc_mutex;
 
 
+/* Magazine capacity and number of buckets moved in one refill or flush */
+#define KMALLOC_MAGSIZE  16
+#define KMALLOC_BATCH    8
+
+
+/*
+ * Per-CPU magazine - stack of free buckets of one size class. Magazines
+ * are accessed only by their own processor with interrupts disabled, so
+ * they don't need kmalloc_mutex. Buckets held in magazines are counted as
+ * allocated in their areas.
+ */
+typedef struct kmalloc_magazine {
+	uint_t  n;
+	void    *objs[KMALLOC_MAGSIZE];
+} kmalloc_magazine_t;
+
+
+kmalloc_magazine_t kmalloc_mags[NCPUS][sizeof(sizes) / sizeof(sizes[0]) - 1];
+
+
 /*
  * Function prepares new kmalloc bucket area. It returns number of created
  * buckets. Function isn't synchronized by kmalloc mutex.
@@ -106,19 +150,52 @@ void prepare_kmalloc_area(area_header_t *areah, uint_t size, uint_t bucket_size,
 	((bucket_header_t *)((void *)fbh + k * real_size))->next = NULL;
 	
 	areah->next = NULL;
+	areah->prev = NULL;
 	areah->first_free = fbh;
 	areah->nbuckets = nbuckets;
+	areah->nused = 0;
 	areah->size = size;
 	areah->idx = idx;	
 	return;
 }
 
 
+/* Function adds area to the partial list of its size class */
+static inline void partial_add(area_header_t *areah)
+{
+	area_header_t **head = &sizes[areah->idx].partial;
+	
+	areah->prev = NULL;
+	areah->next = *head;
+	if (*head != NULL)
+		(*head)->prev = areah;
+	*head = areah;
+	return;
+}
+
+
+/* Function removes area from the partial list of its size class */
+static inline void partial_remove(area_header_t *areah)
+{
+	if (areah->prev != NULL)
+		areah->prev->next = areah->next;
+	else
+		sizes[areah->idx].partial = areah->next;
+	
+	if (areah->next != NULL)
+		areah->next->prev = areah->prev;
+	
+	areah->next = NULL;
+	areah->prev = NULL;
+	return;
+}
+
+
 /* Function initializes kmalloc subsystem */
 int kmalloc_init(uint_t npages)
 {
 	area_header_t *areah;
-	uint_t k = 0;
+	uint_t k = 0, s;
 	
 	unlock(&kmalloc_mutex);
 	
@@ -129,8 +206,10 @@ int kmalloc_init(uint_t npages)
 		
 		prepare_kmalloc_area(areah, npages * PAGE_SIZE, sizes[k].bucket_size, k);
 		kmalloc_npages = npages;
+		kmalloc_pages += npages;
 		
-		sizes[k].first_area = areah;
+		sizes[k].partial = NULL;
+		partial_add(areah);
 		sizes[k].nbuckets = areah->nbuckets;
 		sizes[k].alloc_buckets = 0;
 		k++;
@@ -138,87 +217,187 @@ int kmalloc_init(uint_t npages)
 		if (sizes[k].bucket_size == 0)
 			break;
 	}
+	
+	/* Build size lookup table */
+	for (k = 0, s = 0; s <= KMALLOC_MAXSIZE / 4; s++) {
+		if (s * 4 > sizes[k].bucket_size)
+			k++;
+		kmalloc_idx[s] = k;
+	}
 	return 0;
 }	
 
 
-/* Function allocates bucket */
-void *kmalloc(uint_t size)
+/* Function allocates block larger than the largest bucket */
+static void *kmalloc_large(uint_t size)
 {
-	uint_t real_size;
-	uint_t idx;
-	area_header_t *areah, *last_areah = NULL;
+	uint_t npages, eflags;
+	area_header_t *areah;
 	bucket_header_t *bh;
 	
-	lock(&kmalloc_mutex);
-	
-	real_size  = size + sizeof(bucket_header_t);
-
-	/* Find sizes[] entry */
-	idx = 0;
-	for (;;) {
-		if (size <= sizes[idx].bucket_size)
-			break;
+	/* Page count of the largest sizes would overflow */
+	if (size > (uint_t)-PAGE_SIZE - sizeof(area_header_t) - sizeof(bucket_header_t))
+		return NULL;
+	npages = (size + sizeof(area_header_t) + sizeof(bucket_header_t) + PAGE_SIZE - 1) / PAGE_SIZE;
 	
-		/* If end of sizes is reached return error */
-		if (sizes[idx++].bucket_size == 0) {
+	if ((areah = (area_header_t *)kernel_pages_alloc(npages)) == NULL) {
 #ifdef _DEBUG_KMALLOC
-			printf("kmalloc: block too large (%d bytes).\n", size);
+		printf("kmalloc: out of memory (%d bytes).\n", size);
 #endif
-			unlock(&kmalloc_mutex);
-			return NULL;
-		}
+		return NULL;
 	}
+	
+	areah->next = NULL;
+	areah->prev = NULL;
+	areah->first_free = NULL;
+	areah->nbuckets = 1;
+	areah->nused = 1;
+	areah->size = npages * PAGE_SIZE;
+	areah->idx = KMALLOC_LARGE;
+	
+	bh = (bucket_header_t *)((void *)areah + sizeof(area_header_t));
+	bh->next = (bucket_header_t *)areah;
+	
+	eflags = cli_save();
+	lock(&kmalloc_mutex);
+	kmalloc_pages += npages;
+	unlock(&kmalloc_mutex);
+	restore_flags(eflags);
+	
+	return ((void *)bh + sizeof(bucket_header_t));
+}
 
-	/* Obtain first bucket pointer */
-	if ((areah = sizes[idx].first_area) == NULL) {
-#ifdef _DEBUG_KMALLOC
-		printf("kmalloc subsystem isn't initialized\n");
-#endif
-		unlock(&kmalloc_mutex);
+
+/*
+ * Function takes bucket from the areas of idx size class. It returns NULL
+ * when no area has free bucket. It must be called with kmalloc_mutex locked.
+ */
+static void *kmalloc_bucket_get(uint_t idx)
+{
+	area_header_t *areah;
+	bucket_header_t *bh;
+	
+	if ((areah = sizes[idx].partial) == NULL)
 		return NULL;
+	
+	/* Take first free bucket, full area leaves partial list */
+	bh = areah->first_free;
+	areah->first_free = bh->next;
+	bh->next = (bucket_header_t *)areah;
+	areah->nused++;
+	sizes[idx].alloc_buckets++;
+	
+	if (areah->first_free == NULL)
+		partial_remove(areah);
+	
+	return ((void *)bh + sizeof(bucket_header_t));
+}
+
+
+/*
+ * Function returns bucket to its area. It must be called with kmalloc_mutex
+ * locked. Area which should be returned to the page allocator is removed from
+ * its size class and returned, caller releases it after unlocking.
+ */
+static area_header_t *kmalloc_bucket_put(void *p)
+{
+	bucket_header_t *bh;
+	area_header_t *areah;
+	
+	bh = (bucket_header_t *)(p - sizeof(bucket_header_t));
+	areah = (area_header_t *)bh->next;
+	
+	/* Full area returns to the partial list */
+	if (areah->first_free == NULL)
+		partial_add(areah);
+	
+	/* Now release bucket */
+	bh->next = areah->first_free;
+	areah->first_free = bh;
+	
+	/* And update statistics */
+	areah->nused--;
+	sizes[areah->idx].alloc_buckets--;
+	
+	/*
+	 * Empty area is returned to the page allocator only when the size class
+	 * has at least one more area worth of free buckets. This prevents area
+	 * thrashing when one bucket is allocated and released repeatedly.
+	 */
+	if (!areah->nused &&
+	    (sizes[areah->idx].nbuckets - sizes[areah->idx].alloc_buckets >= 2 * areah->nbuckets)) {
+		partial_remove(areah);
+		sizes[areah->idx].nbuckets -= areah->nbuckets;
+		kmalloc_pages -= areah->size / PAGE_SIZE;
+		return areah;
 	}
+	return NULL;
+}
+
+
+/*
+ * Function allocates bucket. Page allocator is called with kmalloc_mutex
+ * unlocked and caller's interrupt state restored, because it may drain
+ * magazines taking kmalloc_mutex. Zone locks are taken with interrupts
+ * disabled, so kmalloc() can be called with interrupts disabled, but then
+ * refill from the page allocator runs with interrupts disabled too. New area
+ * is prepared outside of critical section and added later.
+ */
+void *kmalloc(uint_t size)
+{
+	uint_t idx, eflags;
+	kmalloc_magazine_t *mag;
+	area_header_t *areah = NULL;
+	void *p;
 	
-	/* Find free bucket */
+	if (size > KMALLOC_MAXSIZE)
+		return kmalloc_large(size);
+	
+	/* Find sizes[] entry */
+	idx = kmalloc_idx[(size + 3) >> 2];
+	
+	eflags = cli_save();
+	mag = &kmalloc_mags[cpu_id()][idx];
+	
+	/* Empty magazine is refilled with a batch of buckets from the areas */
 	for (;;) {
-		
-		/* If free area doesn't exist allocate new one */
-		if (areah == NULL) {		
-#ifdef _DEBUG_KMALLOC
-			printf("kmalloc: before kernel_pages_alloc()\n");
-#endif
-			if ((areah = (area_header_t *)kernel_pages_alloc(kmalloc_npages)) == NULL) {
-#ifdef _DEBUG_KMALLOC
-				printf("kmalloc: out of memory\n");
-#endif
-				unlock(&kmalloc_mutex);
-				return NULL;
+		if ((mag->n == 0) || (areah != NULL)) {
+			lock(&kmalloc_mutex);
+			if (areah != NULL) {
+				partial_add(areah);
+				sizes[idx].nbuckets += areah->nbuckets;
+				kmalloc_pages += kmalloc_npages;
+				areah = NULL;
 			}
 			
-			prepare_kmalloc_area(areah, kmalloc_npages * PAGE_SIZE, sizes[idx].bucket_size, idx);
-			last_areah->next = areah;
-			sizes[idx].nbuckets += areah->nbuckets;
+			while (mag->n < KMALLOC_BATCH) {
+				if ((p = kmalloc_bucket_get(idx)) == NULL)
+					break;
+				mag->objs[mag->n++] = p;
+			}
+			unlock(&kmalloc_mutex);
 		}
 		
-		/* Find free bucket - if it doesn't exist go to the next area */
-		if (areah->first_free == NULL) {
-			if (areah->next == NULL)
-				last_areah = areah;
-			areah = areah->next;
+		if (mag->n)
+			break;
+		
+		/* No area has free bucket, new one is allocated */
+		restore_flags(eflags);
+		if ((areah = (area_header_t *)kernel_pages_alloc(kmalloc_npages)) == NULL) {
+#ifdef _DEBUG_KMALLOC
+			printf("kmalloc: out of memory\n");
+#endif
+			return NULL;
 		}
+		prepare_kmalloc_area(areah, kmalloc_npages * PAGE_SIZE, sizes[idx].bucket_size, idx);
 		
-		/* Uff - bucket is found */
-		else {
-			bh = areah->first_free;
-			areah->first_free = areah->first_free->next;
-			bh->next = (bucket_header_t *)areah;
-			sizes[idx].alloc_buckets++;
-			break;
-		}		
+		eflags = cli_save();
+		mag = &kmalloc_mags[cpu_id()][idx];
 	}
 	
-	unlock(&kmalloc_mutex);
-	return ((void *)bh + sizeof(bucket_header_t));
+	p = mag->objs[--mag->n];
+	restore_flags(eflags);
+	return p;
 }
 
 
@@ -227,8 +406,10 @@ void kfree(void *p)
 {
 	bucket_header_t *bh;
 	area_header_t *areah;
+	kmalloc_magazine_t *mag;
+	area_header_t *empty[KMALLOC_BATCH];
+	uint_t eflags, k, n = 0;
 	
-	lock(&kmalloc_mutex);	
 	bh = (bucket_header_t *)(p - sizeof(bucket_header_t));
 	
 	/* Obtain area header pointer */
@@ -238,17 +419,82 @@ void kfree(void *p)
 #ifdef _DEBUG
 		printf("kfree: bad bucket\n");
 #endif
+		return;
+	}
+	
+	eflags = cli_save();
+	
+	/* Large block is released directly to the page allocator */
+	if (areah->idx == KMALLOC_LARGE) {
+		lock(&kmalloc_mutex);
+		kmalloc_pages -= areah->size / PAGE_SIZE;
 		unlock(&kmalloc_mutex);
+		restore_flags(eflags);
+		kernel_pages_free(areah);
 		return;
 	}
 	
-	/* Now release bucket */
-	bh->next = areah->first_free;
-	areah->first_free = bh;
+	mag = &kmalloc_mags[cpu_id()][areah->idx];
 	
-	/* And update statistics */
-	sizes[areah->idx].alloc_buckets--;
+	/* Full magazine is flushed - its oldest buckets return to the areas */
+	if (mag->n == KMALLOC_MAGSIZE) {
+		lock(&kmalloc_mutex);
+		for (k = 0; k < KMALLOC_BATCH; k++)
+			if ((empty[n] = kmalloc_bucket_put(mag->objs[k])) != NULL)
+				n++;
+		unlock(&kmalloc_mutex);
+		
+		for (k = KMALLOC_BATCH; k < KMALLOC_MAGSIZE; k++)
+			mag->objs[k - KMALLOC_BATCH] = mag->objs[k];
+		mag->n -= KMALLOC_BATCH;
+	}
 	
-	unlock(&kmalloc_mutex);
+	mag->objs[mag->n++] = p;
+	restore_flags(eflags);
+	
+	/* Empty areas are released outside of the magazine critical section */
+	for (k = 0; k < n; k++)
+		kernel_pages_free(empty[k]);
 	return;
 }
+
+
+/*
+ * Function drains magazines of current processor, so areas holding only
+ * cached buckets become empty and can be released. It returns number of
+ * released pages.
+ */
+uint_t kmalloc_reclaim(void)
+{
+	kmalloc_magazine_t *mag;
+	area_header_t *areah, *empty = NULL;
+	uint_t eflags, idx, npages = 0;
+	
+	eflags = cli_save();
+	lock(&kmalloc_mutex);
+	for (idx = 0; sizes[idx].bucket_size; idx++) {
+		mag = &kmalloc_mags[cpu_id()][idx];
+		while (mag->n) {
+			if ((areah = kmalloc_bucket_put(mag->objs[--mag->n])) != NULL) {
+				areah->next = empty;
+				empty = areah;
+			}
+		}
+	}
+	unlock(&kmalloc_mutex);
+	restore_flags(eflags);
+	
+	while ((areah = empty) != NULL) {
+		empty = areah->next;
+		npages += areah->size / PAGE_SIZE;
+		kernel_pages_free(areah);
+	}
+	return npages;
+}
+
+
+/* Function returns number of pages held by kmalloc areas */
+uint_t kmalloc_getpages(void)
+{
+	return kmalloc_pages;
+}
@@ -34,12 +34,31 @@
 extern int kmalloc_init(uint_t npages);
 
 
-/* Function allocates bucket */
+/*
+ * Function allocates bucket. Blocks larger than the largest bucket are
+ * allocated as whole pages. Function may be called with interrupts disabled,
+ * empty magazine is refilled from the page allocator, whose locks are taken
+ * with interrupts disabled.
+ */
 extern void *kmalloc(uint_t size);
 
 
-/* Function releases allocated bucket */
+/*
+ * Function releases allocated bucket. Function may be called with interrupts
+ * disabled, empty areas of flushed magazine are returned to the page allocator.
+ */
 extern void kfree(void *p);
 
 
+/*
+ * Function returns buckets cached in magazines to their areas and releases
+ * empty areas. It returns number of released pages.
+ */
+extern uint_t kmalloc_reclaim(void);
+
+
+/* Function returns number of pages held by kmalloc areas */
+extern uint_t kmalloc_getpages(void);
+
+
 #endif
@@ -0,0 +1,281 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Shared memory segments
+ *
+ * Copyright 2005 Pawel Pisarczyk
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * Phoenix-RTOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Phoenix-RTOS kernel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Phoenix-RTOS kernel; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <hal/current/types.h>
+#include <hal/current/defs.h>
+#include <hal/current/locore.h>
+#include <hal/current/pmap.h>
+#include <init/std.h>
+#include <init/errors.h>
+#include <vm/vm.h>
+#include <vm/kmalloc.h>
+#include <vm/shm.h>
+#include <task/scheduler.h>
+
+
+/* Named shared segment, each page holds one reference of segment and one of every attachment */
+typedef struct _shm_t {
+	struct _shm_t *next;
+	char name[SHM_NAMESZ];
+	int id;
+	uint_t npages;
+	page_t **pages;
+} shm_t;
+
+
+/* List of shared segments */
+static shm_t *shm_list;
+static int shm_lastid;
+static mutex_t shm_mutex;
+
+
+/* Function finds segment by name or by identifier (without locking) */
+static shm_t *shm_find(char *name, int id)
+{
+	shm_t *shm;
+	
+	for (shm = shm_list; shm != NULL; shm = shm->next) {
+		if ((name != NULL) ? !std_strncmp(shm->name, name, SHM_NAMESZ) : (shm->id == id))
+			return shm;
+	}
+	return NULL;
+}
+
+
+/* Function drops segment references to its pages and releases it */
+static void shm_release(shm_t *shm)
+{
+	uint_t k;
+	
+	for (k = 0; k < shm->npages; k++)
+		page_unref(shm->pages[k]);
+	kfree(shm->pages);
+	kfree(shm);
+	return;
+}
+
+
+/* Function initializes list of shared segments */
+void shm_init(void)
+{
+	shm_list = NULL;
+	shm_lastid = 0;
+	unlock(&shm_mutex);
+	return;
+}
+
+
+/* Function creates named shared segment or opens existing one */
+int shm_create(char *name, uint_t size)
+{
+	shm_t *shm, *found;
+	page_t *page, *next;
+	uint_t len, k;
+	int id;
+	
+	len = std_strlen(name);
+	if (!len || (len >= SHM_NAMESZ) || !size || (size > SHM_MAXSIZE))
+		return ERR_ARG;
+	
+	lock(&shm_mutex);
+	if ((found = shm_find(name, 0)) != NULL) {
+		id = (size <= found->npages * PAGE_SIZE) ? found->id : ERR_ARG;
+		unlock(&shm_mutex);
+		return id;
+	}
+	unlock(&shm_mutex);
+	
+	/* Pages are allocated and zeroed without lock */
+	if ((shm = kmalloc(sizeof(shm_t))) == NULL)
+		return ERR_MEM;
+	shm->npages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+	memcpy(shm->name, name, len + 1);
+	
+	if ((shm->pages = kmalloc(shm->npages * sizeof(page_t *))) == NULL) {
+		kfree(shm);
+		return ERR_MEM;
+	}
+	if ((page = area_alloc(shm->npages, REG_MEM | AREA_ZERO)) == NULL) {
+		kfree(shm->pages);
+		kfree(shm);
+		return ERR_MEM;
+	}
+	for (k = 0; page != NULL; k++, page = next) {
+		next = page->next;
+		page->next = NULL;
+		page->prev = NULL;
+		page->refs = 1;
+		shm->pages[k] = page;
+	}
+	
+	/* Segment could be created by other task in meantime */
+	lock(&shm_mutex);
+	if ((found = shm_find(name, 0)) != NULL) {
+		id = (size <= found->npages * PAGE_SIZE) ? found->id : ERR_ARG;
+		unlock(&shm_mutex);
+		shm_release(shm);
+		return id;
+	}
+	shm->id = ++shm_lastid;
+	shm->next = shm_list;
+	shm_list = shm;
+	id = shm->id;
+	unlock(&shm_mutex);
+	
+	return id;
+}
+
+
+/* Function maps whole shared segment at vaddr in task memory map */
+int shm_attach(task_t *task, int id, void *vaddr, uint_t attr)
+{
+	vm_map_t *map = task->vm_map;
+	vm_seg_t *seg;
+	page_t **shared;
+	shm_t *shm;
+	uint_t npages, k;
+	
+	if ((map == NULL) || !vaddr || ((uint_t)vaddr & (PAGE_SIZE - 1)))
+		return ERR_ARG;
+	
+	lock(&shm_mutex);
+	if (((shm = shm_find(NULL, id)) == NULL) || ((uint_t)vaddr > KERNEL_BASE - shm->npages * PAGE_SIZE)) {
+		unlock(&shm_mutex);
+		return ERR_ARG;
+	}
+	npages = shm->npages;
+	unlock(&shm_mutex);
+	
+	if ((shared = kmalloc(npages * sizeof(page_t *))) == NULL)
+		return ERR_MEM;
+	
+	/* Segment could be removed in meantime, size of existing one never changes */
+	lock(&shm_mutex);
+	if ((shm = shm_find(NULL, id)) == NULL) {
+		unlock(&shm_mutex);
+		kfree(shared);
+		return ERR_ARG;
+	}
+	for (k = 0; k < npages; k++) {
+		page_ref(shm->pages[k]);
+		shared[k] = shm->pages[k];
+	}
+	unlock(&shm_mutex);
+	
+	if ((seg = seg_create(NULL, vaddr, npages * PAGE_SIZE, PGHD_PRESENT | PGHD_USER | PGHD_READ)) == NULL) {
+		for (k = 0; k < npages; k++)
+			page_unref(shared[k]);
+		kfree(shared);
+		return ERR_MEM;
+	}
+	if (attr & SHM_WRITE)
+		seg->flags |= PGHD_WRITE;
+	seg->shared = shared;
+	
+	/* Overlapping segment is rejected and released by seg_map() */
+	if (seg_map(map, seg) < 0)
+		return ERR_ARG;
+	
+	for (k = 0; k < npages; k++) {
+		if (pmap_map(map->pmap, shared[k], vaddr + k * PAGE_SIZE, seg->flags) < 0) {
+			seg_unmap(map, seg);
+			return ERR_MEM;
+		}
+	}
+	return 0;
+}
+
+
+/* Function unmaps shared segment attached at vaddr */
+int shm_detach(task_t *task, void *vaddr)
+{
+	vm_map_t *map = task->vm_map;
+	vm_seg_t *seg;
+	
+	if ((map == NULL) || ((seg = seg_find(map, vaddr)) == NULL))
+		return ERR_ARG;
+	
+	/* Only attachments are anonymous segments with shared pages */
+	if ((seg->vaddr != vaddr) || (seg->source != NULL) || (seg->shared == NULL))
+		return ERR_ARG;
+	
+	seg_unmap(map, seg);
+	return 0;
+}
+
+
+/* Function removes segment name, pages are released with the last attachment */
+int shm_remove(int id)
+{
+	shm_t *shm, **prev;
+	
+	lock(&shm_mutex);
+	for (prev = &shm_list; (shm = *prev) != NULL; prev = &shm->next) {
+		if (shm->id == id)
+			break;
+	}
+	if (shm == NULL) {
+		unlock(&shm_mutex);
+		return ERR_ARG;
+	}
+	*prev = shm->next;
+	unlock(&shm_mutex);
+	
+	shm_release(shm);
+	return 0;
+}
+
+
+/* shm_create (PSC) */
+void psc_shmcreate(char *name, uint_t size, int *id)
+{
+	*id = shm_create(name, size);
+	return;
+}
+
+
+/* shm_attach (PSC) */
+void psc_shmattach(int id, void *vaddr, uint_t attr, int *err)
+{
+	*err = shm_attach(scheduler_getcurrent(), id, vaddr, attr);
+	return;
+}
+
+
+/* shm_detach (PSC) */
+void psc_shmdetach(void *vaddr, int *err)
+{
+	*err = shm_detach(scheduler_getcurrent(), vaddr);
+	return;
+}
+
+
+/* shm_remove (PSC) */
+void psc_shmremove(int id, int *err)
+{
+	*err = shm_remove(id);
+	return;
+}
@@ -0,0 +1,84 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Shared memory segments
+ *
+ * Copyright 2005 Pawel Pisarczyk
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * Phoenix-RTOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Phoenix-RTOS kernel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Phoenix-RTOS kernel; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _SHM_H_
+#define _SHM_H_
+
+#include <hal/current/types.h>
+#include <task/task.h>
+
+
+/* Maximum length of shared segment name and maximum segment size */
+#define SHM_NAMESZ   32
+#define SHM_MAXSIZE  0x400000
+
+/* Attach attributes */
+#define SHM_WRITE    0x01
+
+
+/* Function initializes list of shared segments */
+extern void shm_init(void);
+
+
+/*
+ * Function creates named shared segment of size bytes or opens existing one.
+ * It returns segment identifier or error code.
+ */
+extern int shm_create(char *name, uint_t size);
+
+
+/*
+ * Function maps whole shared segment at vaddr in task memory map. Pages are
+ * referenced by attachment, so they outlive removal of the segment.
+ */
+extern int shm_attach(task_t *task, int id, void *vaddr, uint_t attr);
+
+
+/* Function unmaps shared segment attached at vaddr */
+extern int shm_detach(task_t *task, void *vaddr);
+
+
+/* Function removes segment name, pages are released with the last attachment */
+extern int shm_remove(int id);
+
+
+/* shm_create (PSC) */
+extern void psc_shmcreate(char *name, uint_t size, int *id);
+
+
+/* shm_attach (PSC) */
+extern void psc_shmattach(int id, void *vaddr, uint_t attr, int *err);
+
+
+/* shm_detach (PSC) */
+extern void psc_shmdetach(void *vaddr, int *err);
+
+
+/* shm_remove (PSC) */
+extern void psc_shmremove(int id, int *err);
+
+
+#endif
@@ -31,6 +31,7 @@
 #include <init/std.h>
 #include <vm/vm.h>
 #include <vm/kmalloc.h>
+#include <vm/cache.h>
 
 
 /* Global memory map */
@@ -39,15 +40,258 @@ mem_map_t mem_map;
 /* Size of physical memory - variable is set by bootstrap code */
 uint_t physmem_size = 0;
 
+/* Caches of memory maps and segment descriptors */
+cache_t *map_cache;
+cache_t *seg_cache;
 
-/* Function creates memory map obtaining description from pmap_get_page() */
-void init_mem_map(uint_t size)
+/* Mutex protecting reference counters of shared pages, held with interrupts disabled */
+mutex_t refs_mutex;
+
+
+/*
+ * Zone fallback lists for allocation classes (indexed by DMA_MEM, REG_MEM and
+ * KERNEL_MEM). Only the first zone on the list can be exhausted completely,
+ * other zones keep their reserve for own callers.
+ */
+static uint_t zonelists[3][NZONES + 1] = {
+	{ ZONE_DMA, NZONES },
+	{ ZONE_NORMAL, ZONE_DMA, NZONES },
+	{ ZONE_NORMAL, ZONE_DMA, NZONES }
+};
+
+
+/* Function returns zone containing page given by index */
+static inline zone_t *page_zone(uint_t idx)
+{
+	if (idx < mem_map.zones[ZONE_DMA].start + mem_map.zones[ZONE_DMA].size)
+		return &mem_map.zones[ZONE_DMA];
+	return &mem_map.zones[ZONE_NORMAL];
+}
+
+
+/* Function adds free block to the zone free list of given order */
+static inline void buddy_insert(zone_t *zone, page_t *page, uint_t order)
+{
+	page_t **head = &zone->free[order];
+	
+	page->flags |= PG_BUDDY;
+	page->order = order;
+	
+	if (*head == NULL) {
+		page->next = page;
+		page->prev = page;
+	}
+	else {
+		page->next = *head;
+		page->prev = (*head)->prev;
+		(*head)->prev->next = page;
+		(*head)->prev = page;
+	}
+	*head = page;
+	return;
+}
+
+
+/* Function removes free block from its free list */
+static inline void buddy_remove(zone_t *zone, page_t *page)
+{
+	page_t **head = &zone->free[page->order];
+	
+	if (page->next == page)
+		*head = NULL;
+	else {
+		page->prev->next = page->next;
+		page->next->prev = page->prev;
+		if (*head == page)
+			*head = page->next;
+	}
+	
+	page->flags &= ~PG_BUDDY;
+	page->next = NULL;
+	page->prev = NULL;
+	return;
+}
+
+
+/* Function releases block of given order and merges it with free buddies */
+static void buddy_free(zone_t *zone, page_t *page, uint_t order)
+{
+	uint_t idx, bidx;
+	page_t *buddy;
+	
+	idx = page - mem_map.first_page;
+	
+	while (order < MAX_ORDER - 1) {
+		bidx = idx ^ (1 << order);
+		if ((bidx < zone->start) || (bidx + (1 << order) > zone->start + zone->size))
+			break;
+		
+		buddy = mem_map.first_page + bidx;
+		if (!IS_BUDDY(buddy->flags) || (buddy->order != order))
+			break;
+		
+		buddy_remove(zone, buddy);
+		idx &= bidx;
+		order++;
+	}
+	
+	buddy_insert(zone, mem_map.first_page + idx, order);
+	return;
+}
+
+
+/* Function releases range of n pages starting from page idx dividing it into aligned blocks */
+static void buddy_freerange(zone_t *zone, uint_t idx, uint_t n)
+{
+	uint_t order;
+	
+	while (n) {
+		for (order = MAX_ORDER - 1; order; order--) {
+			if (!(idx & ((1 << order) - 1)) && ((1 << order) <= n))
+				break;
+		}
+		
+		buddy_free(zone, mem_map.first_page + idx, order);
+		idx += (1 << order);
+		n -= (1 << order);
+	}
+	return;
+}
+
+
+/*
+ * Function takes block of given order from zone free lists. If there is no such
+ * block larger one is split and unused halves are returned to the free lists.
+ */
+static page_t *buddy_take(zone_t *zone, uint_t order)
+{
+	uint_t k;
+	page_t *page;
+	
+	for (k = order; k < MAX_ORDER; k++) {
+		if ((page = zone->free[k]) == NULL)
+			continue;
+		
+		buddy_remove(zone, page);
+		while (k > order) {
+			k--;
+			buddy_insert(zone, page + (1 << k), k);
+		}
+		return page;
+	}
+	return NULL;
+}
+
+
+/* Function marks n pages starting from page as reserved and appends them to the area list */
+static inline void area_link(page_t **first, page_t **last, page_t *page, uint_t n)
 {
 	uint_t k;
+	
+	for (k = 0; k < n; k++, page++) {
+		page->flags |= PG_RSVD;
+		page->next = NULL;
+		page->prev = *last;
+		if (*last != NULL)
+			(*last)->next = page;
+		else
+			*first = page;
+		*last = page;
+	}
+	return;
+}
+
+
+/* Function returns order of the smallest block containing n pages */
+static inline uint_t buddy_order(uint_t n)
+{
+	uint_t order;
+	
+	for (order = 0; (1 << order) < n; order++);
+	return order;
+}
+
+
+/* Function allocates physically coherent area from the zone */
+static page_t *zone_alloc_coherent(zone_t *zone, uint_t size, uint_t reserve)
+{
+	page_t *page, *first = NULL, *last = NULL;
+	uint_t order = buddy_order(size), eflags;
+	
+	if (order >= MAX_ORDER)
+		return NULL;
+	
+	eflags = cli_save();
+	lock(&zone->mutex);
+	
+	if ((zone->total_free < size + reserve) || ((page = buddy_take(zone, order)) == NULL)) {
+		unlock(&zone->mutex);
+		restore_flags(eflags);
+		return NULL;
+	}
+	
+	/* Return unused tail of the block */
+	if ((1 << order) > size)
+		buddy_freerange(zone, page - mem_map.first_page + size, (1 << order) - size);
+	
+	area_link(&first, &last, page, size);
+	zone->total_free -= size;
+	
+	unlock(&zone->mutex);
+	restore_flags(eflags);
+	return first;
+}
+
+
+/*
+ * Function allocates up to size pages from the zone and appends them to the area
+ * list. Area is built from the largest available blocks. Function returns number
+ * of allocated pages.
+ */
+static uint_t zone_alloc_pages(zone_t *zone, uint_t size, uint_t reserve, page_t **first, page_t **last)
+{
+	uint_t n, k, order, eflags;
 	page_t *page;
 	
-	/* Memory map mutex initialization */
-	unlock(&mem_map.mutex);
+	eflags = cli_save();
+	lock(&zone->mutex);
+	
+	if (zone->total_free <= reserve) {
+		unlock(&zone->mutex);
+		restore_flags(eflags);
+		return 0;
+	}
+	n = min(size, zone->total_free - reserve);
+	
+	for (k = n; k; k -= (1 << order)) {
+	
+		/* Prefer existing blocks not larger than the rest of request */
+		order = min(buddy_order(k + 1) - 1, MAX_ORDER - 1);
+		while (order && (zone->free[order] == NULL))
+			order--;
+		
+		/* Split larger block */
+		if (zone->free[order] == NULL)
+			order = min(buddy_order(k + 1) - 1, MAX_ORDER - 1);
+		
+		page = buddy_take(zone, order);
+		area_link(first, last, page, 1 << order);
+	}
+	zone->total_free -= n;
+	
+	unlock(&zone->mutex);
+	restore_flags(eflags);
+	return n;
+}
+
+
+/* Function creates memory map obtaining description from pmap_getrange() */
+void init_mem_map(uint_t size)
+{
+	uint_t k, n, start, end, dma_end = 0;
+	pmap_range_t range;
+	page_t *page;
+	zone_t *zone;
 	
 	/*
 	 * Memory map begins from end of the statically allocated kernel memory pointed
@@ -57,215 +301,269 @@ void init_mem_map(uint_t size)
 	 * near future. 
 	 */
 	mem_map.first_page = (page_t *)(KERNEL_BASE + pmap_get_kmem_top());
-
-	for (k = 0; k < size / PAGE_SIZE; k ++) {
-		page = pmap_getphyspage(size, mem_map.first_page + k, k);
-		
-		if (IS_KERNEL(page->flags)) {
-			mem_map.kernel_mem++;
+	mem_map.size = size / PAGE_SIZE;
+	
+	/* Page descriptors are initialized in bulk, range by range */
+	for (n = 0; pmap_getrange(n, &range) == 0; n++) {
+		for (k = range.start, page = mem_map.first_page + k; k < range.end; k++, page++) {
+			page->flags = range.flags;
+			page->next = NULL;
+			page->prev = NULL;
+			page->num = k;
+			page->order = 0;
+			page->refs = 0;
 		}
 		
-		if (IS_FREE(page->flags))
-			mem_map.total_free++;
-
-		if (IS_DMA(page->flags))
-			mem_map.dma_free++;
-	}	
-	mem_map.size = k;
+		if (IS_KERNEL(range.flags))
+			mem_map.kernel_mem += range.end - range.start;
+		if (IS_DMA(range.flags))
+			dma_end = range.end;
+	}
+	
+	/* DMA zone covers pages up to the last DMA page, normal zone the rest */
+	for (k = 0; k < NZONES; k++) {
+		zone = &mem_map.zones[k];
+		unlock(&zone->mutex);
+		for (start = 0; start < MAX_ORDER; start++)
+			zone->free[start] = NULL;
+		zone->total_free = 0;
+		zone->reserve = 0;
+	}
+	mem_map.zones[ZONE_DMA].start = 0;
+	mem_map.zones[ZONE_DMA].size = dma_end;
+	mem_map.zones[ZONE_NORMAL].start = dma_end;
+	mem_map.zones[ZONE_NORMAL].size = mem_map.size - dma_end;
+	
+	/* Put free ranges on zone free lists, range crossing zone boundary is split */
+	for (n = 0; pmap_getrange(n, &range) == 0; n++) {
+		if (!IS_FREE(range.flags))
+			continue;
+		
+		for (start = range.start; start < range.end; start = end) {
+			zone = page_zone(start);
+			end = (range.end < zone->start + zone->size) ? range.end : zone->start + zone->size;
+			
+			zone->total_free += end - start;
+			buddy_freerange(zone, start, end - start);
+		}
+	}
+	
+	/* Part of DMA memory is kept for DMA callers */
+	mem_map.zones[ZONE_DMA].reserve = mem_map.zones[ZONE_DMA].total_free / DMA_RESERVE;
+	
+	unlock(&mem_map.zmutex);
+	mem_map.zeroed = NULL;
+	mem_map.nzeroed = 0;
+	
+	mem_map.tsc = (cpu_features() & CPUID_TSC) ? 1 : 0;
+	mem_map.ncalls = 0;
+	for (k = 0; k < 3; k++)
+		mem_map.failed[k] = 0;
+	for (k = 0; k < MEMSTATS_NLAT; k++)
+		mem_map.latency[k] = 0;
 	
 	return;
 }
 
 
-/* Function finds coherent area starting from address given by page */
-static inline page_t *find_coherent(uint_t size, page_t *page, uint_t spn, uint_t dest)
+/* Function allocates area (list of pages) from zones */
+static page_t *area_take(uint_t size, uint_t dest)
 {
-	uint_t i;
-	page_t *tpage;
+	uint_t *zl, n = 0;
+	page_t *first = NULL, *last = NULL;
+	zone_t *zone;
 	
-	for (i = 1; i < size; i++) {
-		if (spn + i >= mem_map.size)
-			return NULL;
-		
-		tpage = page + i;
-			 		
-		/* DMA allocation */
-		if (dest == DMA_MEM) {
+	if (!size)
+		return NULL;
+	
+	for (zl = zonelists[dest]; *zl != NZONES; zl++) {
+		zone = &mem_map.zones[*zl];
 		
-			/* There is no DMA page */
-			if ((!IS_FREE(tpage->flags)) || (!IS_DMA(tpage->flags)))
-				return NULL;
+		/* Regular allocation - area can be gathered from many zones */
+		if (dest == REG_MEM) {
+			n += zone_alloc_pages(zone, size - n, (zl == zonelists[dest]) ? 0 : zone->reserve, &first, &last);
+			if (n == size)
+				return first;
 		}
 		
-		/* Kernel allocation */
+		/* Kernel and DMA allocation - area must be physically coherent */
 		else {
-			if (!IS_FREE(tpage->flags))
-				return NULL;
+			if ((first = zone_alloc_coherent(zone, size, (zl == zonelists[dest]) ? 0 : zone->reserve)) != NULL)
+				return first;
 		}
-		
-		/* Add to list */
-		tpage->prev = tpage - 1;
-		tpage->prev->next = tpage;
-		tpage->next = NULL;		
-	}
-		
-	/* If memory is allocated mark all pages reserved, and decrease counters */
-	for (i = 0; i < size; i++) {
-		if (IS_DMA((page + i)->flags)) mem_map.dma_free--;
-		(page + i)->flags |= PG_RSVD;
 	}
 	
-	return page;
+	if (first != NULL)
+		area_free(first);
+	return NULL;
 }
 
 
-/* Function marks pages as reserved */
-static inline void alloc_pages(page_t *page)
+/* Function takes page from the pool of pre-zeroed pages */
+static page_t *zeropool_get(void)
 {
-	page_t *temp;
+	page_t *page;
+	uint_t eflags;
 	
-	temp = page;	
-	do {
-		temp->flags |= PG_RSVD;
-		
-		if (IS_DMA(temp->flags))
-			mem_map.dma_free--;
+	eflags = cli_save();
+	lock(&mem_map.zmutex);
+	if ((page = mem_map.zeroed) != NULL) {
+		mem_map.zeroed = page->next;
+		page->next = NULL;
+		mem_map.nzeroed--;
+	}
+	unlock(&mem_map.zmutex);
+	restore_flags(eflags);
+	return page;
+}
 
-		temp = temp->next;
-	} while (temp != NULL);
-	return;
+
+/* Function returns pre-zeroed pages to zones */
+static uint_t zeropool_flush(void)
+{
+	page_t *page;
+	uint_t n, eflags;
+	
+	eflags = cli_save();
+	lock(&mem_map.zmutex);
+	page = mem_map.zeroed;
+	n = mem_map.nzeroed;
+	mem_map.zeroed = NULL;
+	mem_map.nzeroed = 0;
+	unlock(&mem_map.zmutex);
+	restore_flags(eflags);
+	
+	area_free(page);
+	return n;
 }
 
 
-/* Function marks pages as free */
-static inline void free_pages(page_t *page)
+/* Function zeroes free pages of normal zone and puts them to the pool */
+uint_t zeropool_fill(uint_t n)
 {
-	page_t *temp;
+	page_t *page, *last;
+	uint_t k, eflags;
 	
-	temp = page;
+	for (k = 0; k < n; k++) {
+		if (mem_map.nzeroed >= ZEROPOOL_MAX)
+			break;
 		
-	do {
-		temp->flags &= (~PG_RSVD);
-				
-		/* Update statistics */
-		if (IS_DMA(temp->flags))
-			mem_map.dma_free++;
-
-		mem_map.total_free++;
+		page = last = NULL;
+		if (!zone_alloc_pages(&mem_map.zones[ZONE_NORMAL], 1, 4 * ZEROPOOL_MAX, &page, &last))
+			break;
+		memclr((void *)(KERNEL_BASE + page->num * PAGE_SIZE), PAGE_SIZE);
 		
-		temp = temp->next;
-	} while (temp != NULL);
+		eflags = cli_save();
+		lock(&mem_map.zmutex);
+		page->next = mem_map.zeroed;
+		mem_map.zeroed = page;
+		mem_map.nzeroed++;
+		unlock(&mem_map.zmutex);
+		restore_flags(eflags);
+	}
+	return k;
+}
+
+
+/*
+ * Function allocates area (list of pages). If AREA_ZERO is set in dest pages
+ * are zeroed, single pages are taken from the pool of pre-zeroed pages.
+ */
+static page_t *area_get(uint_t size, uint_t dest)
+{
+	uint_t zero = dest & AREA_ZERO, n;
+	page_t *first, *page;
 	
-	return;
+	dest &= ~AREA_ZERO;
+	
+	if (zero && (size == 1) && (dest != DMA_MEM) && ((page = zeropool_get()) != NULL))
+		return page;
+	
+	/*
+	 * Pre-zeroed pages and buckets cached in kmalloc magazines are kept free
+	 * memory, they are released when zones are exhausted
+	 */
+	if ((first = area_take(size, dest)) == NULL) {
+		n = kmalloc_reclaim();
+		if (dest != DMA_MEM)
+			n += zeropool_flush();
+		if (!n || ((first = area_take(size, dest)) == NULL))
+			return NULL;
+	}
+	
+	if (zero) {
+		for (page = first; page != NULL; page = page->next)
+			memclr((void *)(KERNEL_BASE + page->num * PAGE_SIZE), PAGE_SIZE);
+	}
+	return first;
 }
 
 
-/* Function allocates area (list of pages) */
+/*
+ * Function allocates area and updates allocator statistics. Counters are
+ * updated without lock, they are used only for diagnostics.
+ */
 page_t *area_alloc(uint_t size, uint_t dest)
 {
-	uint_t k;
-	page_t *page, *tpage;
-	page_t *res;
-	page_t *last = NULL;
-	char found = 0;
-	uint_t cnt = 0;
-		
-	lock(&mem_map.mutex);
+	uint_t t = 0, k, sample;
+	page_t *first;
 	
-	if (mem_map.total_free < size) {
-		unlock(&mem_map.mutex);
-		return NULL;
-	}
+	if ((sample = (mem_map.tsc && !(mem_map.ncalls++ % MEMSTATS_SAMPLE))))
+		t = get_cycles();
 	
-	page = mem_map.first_page + 1;
-	
-	/* DMA allocation */
-	if (dest == DMA_MEM) {
-		for (k = 1; k < mem_map.size; k++) {
-			 
-			/* Find first page for DMA */
-			if ((IS_FREE(page->flags)) && (IS_DMA(page->flags))) {
-				page->prev = NULL;
-				page->next = NULL;
-				
-				/* Test next pages */
-				if (find_coherent(size, page, k, dest) != NULL) {
-					found = 1;
-					break;
-				}
-			}
-			page++;
-		}
+	if (((first = area_get(size, dest)) == NULL) && size)
+		mem_map.failed[dest & ~AREA_ZERO]++;
+	
+	if (sample) {
+		t = get_cycles() - t;
+		for (k = 0; (k < MEMSTATS_NLAT - 1) && (t >= (512 << k)); k++)
+			;
+		mem_map.latency[k]++;
 	}
+	return first;
+}
+
+
+/* Function releases page list */
+void area_free(page_t *page)
+{
+	page_t *start, *next;
+	zone_t *zone = NULL;
+	uint_t n, eflags;
 	
-	/* Kernel allocation - area must be physically coherent */
-	if (dest == KERNEL_MEM) {
-		for (k = 1; k < mem_map.size; k++) {			 
-			if (IS_FREE(page->flags)) {
-				page->prev = NULL;
-				page->next = NULL;
-				
-				if (find_coherent(size, page, k, dest) != NULL) {
-					found = 1;
-					break;
-				}
-			}
-			page++;
+	eflags = cli_save();
+	while (page != NULL) {
+		
+		/* Pages released in a row usually belong to the same zone */
+		if (page_zone(page - mem_map.first_page) != zone) {
+			if (zone != NULL)
+				unlock(&zone->mutex);
+			zone = page_zone(page - mem_map.first_page);
+			lock(&zone->mutex);
 		}
-	}
 		
-	/* Regular allocation */
-	if (dest == REG_MEM) {
-		tpage = page;
-		for (k = 1; k < mem_map.size; k++) {
+		/* Find run of physically coherent pages and release it at once */
+		start = page;
+		for (n = 1;; n++) {
+			page->flags &= ~PG_RSVD;
 			
-			if (IS_FREE(tpage->flags)) {
-				if (last == NULL) {
-					tpage->prev = NULL;
-					tpage->next = NULL;
-					last = tpage;
-					
-					page = tpage;
-					cnt++;
-				}	
-				else {
-					tpage->prev = last;
-					tpage->prev->next = tpage;
-					tpage->next = NULL;
-					last = tpage;
-					cnt++;
-				}
-			}
+			next = page->next;
+			page->next = NULL;
+			page->prev = NULL;
 			
-			/* If area found set flag */
-			if (cnt == size) {
-				alloc_pages(page);
-				found = 1;
+			if ((next != page + 1) || (page_zone(next - mem_map.first_page) != zone))
 				break;
-			}
-			tpage++;
+			page = next;
 		}
+		
+		zone->total_free += n;
+		buddy_freerange(zone, start - mem_map.first_page, n);
+		page = next;
 	}
 	
-	/* If area found update statistics */
-	if (found) {
-		mem_map.total_free -= size;
-		res = page;
-	}
-	else
-		res = NULL;
-	
-	unlock(&mem_map.mutex);
-	return res;
-}
-
-
-/* Function releases page list */
-void area_free(page_t *page)
-{
-	lock(&mem_map.mutex);
-	free_pages(page);			
-	unlock(&mem_map.mutex);
+	if (zone != NULL)
+		unlock(&zone->mutex);
+	restore_flags(eflags);
 	return;
 }
 
@@ -273,9 +571,7 @@ void area_free(page_t *page)
 /* Function releases pages allocated for kernel */
 void kernel_pages_free(void *addr)
 {
-	page_t *p = mem_map.first_page + (uint_t)(addr - KERNEL_BASE) / PAGE_SIZE;
-	
-	area_free(p);
+	area_free(kernel_page(addr));
 	return;
 }
 
@@ -283,12 +579,11 @@ void kernel_pages_free(void *addr)
 /* Function prints memory usage statistics */
 void disp_meminfo(void)
 {
-	lock(&mem_map.mutex);
-	
-	std_printf("meminfo: total free: %d KB, kernel rsvd: %d KB, dma free: %d KB\n",
-	           mem_map.total_free * 4, mem_map.kernel_mem * 4, mem_map.dma_free * 4);
+	meminfo_t mi;
 	
-	unlock(&mem_map.mutex);
+	get_meminfo(&mi);
+	std_printf("meminfo: total free: %d KB, kernel rsvd: %d KB, dma free: %d KB, kmalloc: %d KB\n",
+	           mi.total_free / 1024, mi.kernel_rsvd / 1024, mi.dma_free / 1024, mi.kmalloc / 1024);
 	return;
 }
 
@@ -296,12 +591,64 @@ void disp_meminfo(void)
 /* Function returns memory usage statistics (PSC) */
 void get_meminfo(meminfo_t *mi)
 {
-	lock(&mem_map.mutex);	
+	uint_t k, eflags;
+	
 	mi->total = mem_map.size * PAGE_SIZE;
-	mi->total_free = mem_map.total_free * PAGE_SIZE;
+	mi->total_free = 0;
 	mi->kernel_rsvd = mem_map.kernel_mem * PAGE_SIZE;
-	mi->dma_free = mem_map.dma_free * PAGE_SIZE;
-	unlock(&mem_map.mutex);
+	
+	for (k = 0; k < NZONES; k++) {
+		eflags = cli_save();
+		lock(&mem_map.zones[k].mutex);
+		mi->total_free += mem_map.zones[k].total_free * PAGE_SIZE;
+		if (k == ZONE_DMA)
+			mi->dma_free = mem_map.zones[k].total_free * PAGE_SIZE;
+		unlock(&mem_map.zones[k].mutex);
+		restore_flags(eflags);
+	}
+	mi->total_free += mem_map.nzeroed * PAGE_SIZE;
+	mi->kmalloc = kmalloc_getpages() * PAGE_SIZE;
+	return;
+}
+
+
+/* Function returns allocator statistics (PSC) */
+void get_memstats(memstats_t *ms)
+{
+	memstats_t stats;
+	uint_t k, order, n, eflags;
+	page_t *page;
+	zone_t *zone;
+	
+	/* Statistics are collected locally, touching user buffer may fault and allocate pages */
+	for (k = 0; k < NZONES; k++) {
+		zone = &mem_map.zones[k];
+		stats.largest[k] = 0;
+		
+		eflags = cli_save();
+		lock(&zone->mutex);
+		stats.free[k] = zone->total_free;
+		for (order = 0; order < MAX_ORDER; order++) {
+			n = 0;
+			if ((page = zone->free[order]) != NULL) {
+				do {
+					n++;
+					page = page->next;
+				} while (page != zone->free[order]);
+				stats.largest[k] = 1 << order;
+			}
+			stats.blocks[k][order] = n;
+		}
+		unlock(&zone->mutex);
+		restore_flags(eflags);
+	}
+	
+	for (k = 0; k < 3; k++)
+		stats.failed[k] = mem_map.failed[k];
+	for (k = 0; k < MEMSTATS_NLAT; k++)
+		stats.latency[k] = mem_map.latency[k];
+	
+	memcpy(ms, &stats, sizeof(memstats_t));
 	return;
 }
 
@@ -324,83 +671,441 @@ vm_map_t *map_create(void)
 {
 	vm_map_t *map;
 	
-	if ((map = kmalloc(sizeof(vm_map_t))) == NULL)
+	if ((map = cache_alloc(map_cache)) == NULL)
 		return NULL;
 	
-	if ((map->pmap = pmap_create()) == NULL)
+	if ((map->pmap = pmap_create()) == NULL) {
+		cache_free(map_cache, map);
 		return NULL;
+	}
 		
-	map->segs = NULL;	
+	map->segs = NULL;
+	map->nsegs = 0;
+	map->maxsegs = 0;
+	map->image = NULL;
+	map->heap_base = NULL;
+	map->heap = NULL;
 	return map;
 }
 
 
-/* Function creates virtual memory segment */
-vm_seg_t *seg_create(page_t *pages, void *vaddr, uint_t flags)
+/*
+ * Function creates virtual memory segment of size bytes. Missing pages
+ * (all when pages is NULL) are allocated on first access.
+ */
+vm_seg_t *seg_create(page_t *pages, void *vaddr, uint_t size, uint_t flags)
 {
 	vm_seg_t *seg;
 	
-	if ((seg = kmalloc(sizeof(vm_seg_t))) == NULL)
+	if ((seg = cache_alloc(seg_cache)) == NULL)
 		return NULL;
 	
 	seg->pages = pages;
 	seg->vaddr = vaddr;
+	seg->size = size;
 	seg->flags = flags;
+	seg->source = NULL;
+	seg->pgoff = 0;
+	seg->shared = NULL;
 
 	return seg;
 }
 
 
-/* Function maps segment to tasks virtual space */
+/* Function releases segment which isn't mapped */
+void seg_free(vm_seg_t *seg)
+{
+	uint_t k;
+	
+	area_free(seg->pages);
+	
+	/* Drop references to image pages */
+	if (seg->shared != NULL) {
+		for (k = 0; k < seg->size / PAGE_SIZE; k++)
+			if (seg->shared[k] != NULL)
+				page_unref(seg->shared[k]);
+		kfree(seg->shared);
+	}
+	cache_free(seg_cache, seg);
+	return;
+}
+
+
+/* Function returns index of the first segment starting above vaddr */
+static uint_t seg_search(vm_map_t *map, void *vaddr)
+{
+	uint_t l = 0, r = map->nsegs, m;
+	
+	while (l < r) {
+		m = (l + r) / 2;
+		if (map->segs[m]->vaddr <= vaddr)
+			l = m + 1;
+		else
+			r = m;
+	}
+	return l;
+}
+
+
+/* Function makes room for one more segment in the segment table */
+static int seg_reserve(vm_map_t *map)
+{
+	vm_seg_t **segs;
+	uint_t n;
+	
+	if (map->nsegs < map->maxsegs)
+		return 0;
+	
+	n = map->maxsegs ? map->maxsegs * 2 : 8;
+	if ((segs = kmalloc(n * sizeof(vm_seg_t *))) == NULL)
+		return -1;
+	
+	if (map->segs != NULL) {
+		memcpy(segs, map->segs, map->nsegs * sizeof(vm_seg_t *));
+		kfree(map->segs);
+	}
+	map->segs = segs;
+	map->maxsegs = n;
+	return 0;
+}
+
+
+/* Function inserts segment at position idx of the segment table */
+static inline void seg_insert(vm_map_t *map, vm_seg_t *seg, uint_t idx)
+{
+	uint_t k;
+	
+	for (k = map->nsegs; k > idx; k--)
+		map->segs[k] = map->segs[k - 1];
+	map->segs[idx] = seg;
+	map->nsegs++;
+	return;
+}
+
+
+/*
+ * Function maps segment to tasks virtual space. Segment overlapping
+ * already mapped one is rejected and released.
+ */
 int seg_map(vm_map_t *map, vm_seg_t *seg)
 {
-	uint_t k = 0;
-	page_t *p;
+	uint_t idx;
+	
+	idx = seg_search(map, seg->vaddr);
 	
-	/* Add segment description to double linked list */
-	if (map->segs == NULL) {
-		map->segs = seg;
-		seg->next = NULL;
-		seg->prev = NULL;
+	if (((idx > 0) && (map->segs[idx - 1]->vaddr + map->segs[idx - 1]->size > seg->vaddr)) ||
+	    ((idx < map->nsegs) && (map->segs[idx]->vaddr < seg->vaddr + seg->size)) ||
+	    (seg_reserve(map) < 0)) {
+		seg_free(seg);
+		return -1;
 	}
-	else {
-		seg->next = map->segs;
-		map->segs->prev = seg;
-		seg->prev = NULL;		
-		map->segs = seg;
+	seg_insert(map, seg, idx);
+	
+	return pmap_map_range(map->pmap, seg->pages, seg->vaddr, seg->flags);
+}
+
+
+/* Function returns segment containing vaddr */
+vm_seg_t *seg_find(vm_map_t *map, void *vaddr)
+{
+	vm_seg_t *seg;
+	uint_t idx;
+	
+	if ((idx = seg_search(map, vaddr)) == 0)
+		return NULL;
+	
+	seg = map->segs[idx - 1];
+	if (vaddr < seg->vaddr + seg->size)
+		return seg;
+	return NULL;
+}
+
+
+/* Function splits segment at vaddr and returns its upper part */
+vm_seg_t *seg_split(vm_map_t *map, vm_seg_t *seg, void *vaddr)
+{
+	vm_seg_t *upper;
+	page_t *page;
+	uint_t n, k, pn;
+	
+	if (((uint_t)vaddr & (PAGE_SIZE - 1)) || (vaddr <= seg->vaddr) || (vaddr >= seg->vaddr + seg->size))
+		return NULL;
+	
+	n = (vaddr - seg->vaddr) / PAGE_SIZE;
+	
+	if (seg_reserve(map) < 0)
+		return NULL;
+	if ((upper = seg_create(NULL, vaddr, seg->vaddr + seg->size - vaddr, seg->flags)) == NULL)
+		return NULL;
+	
+	upper->source = seg->source;
+	upper->pgoff = seg->pgoff + n;
+	
+	if (seg->shared != NULL) {
+		if ((upper->shared = kmalloc(upper->size / PAGE_SIZE * sizeof(page_t *))) == NULL) {
+			cache_free(seg_cache, upper);
+			return NULL;
+		}
+		memcpy(upper->shared, seg->shared + n, upper->size / PAGE_SIZE * sizeof(page_t *));
 	}
 	
-	for (p = seg->pages; p != NULL; p = p->next)
-		if (pmap_map(map->pmap, p, seg->vaddr + k++ * PAGE_SIZE, seg->flags) < 0)
+	/* Move private pages mapped in the upper part */
+	for (k = 0; k < upper->size / PAGE_SIZE; k++) {
+		if ((upper->shared != NULL) && (upper->shared[k] != NULL))
+			continue;
+		if (pmap_getpn(map->pmap, vaddr + k * PAGE_SIZE, &pn) < 0)
+			continue;
+		
+		page = mem_map.first_page + pn;
+		if (page->prev != NULL)
+			page->prev->next = page->next;
+		else
+			seg->pages = page->next;
+		if (page->next != NULL)
+			page->next->prev = page->prev;
+		
+		page->prev = NULL;
+		page->next = upper->pages;
+		if (upper->pages != NULL)
+			upper->pages->prev = page;
+		upper->pages = page;
+	}
+	
+	seg->size = vaddr - seg->vaddr;
+	seg_insert(map, upper, seg_search(map, seg->vaddr));
+	return upper;
+}
+
+
+/* Function merges segment with the following one if they are compatible */
+int seg_merge(vm_map_t *map, vm_seg_t *seg)
+{
+	vm_seg_t *next;
+	page_t **shared, *page;
+	uint_t idx, k;
+	
+	idx = seg_search(map, seg->vaddr);
+	if ((idx == 0) || (map->segs[idx - 1] != seg) || (idx == map->nsegs))
+		return -1;
+	next = map->segs[idx];
+	
+	if ((seg->vaddr + seg->size != next->vaddr) || (seg->flags != next->flags) ||
+	    (seg->source != next->source) || ((seg->shared == NULL) != (next->shared == NULL)))
+		return -1;
+	if ((seg->source != NULL) && (seg->pgoff + seg->size / PAGE_SIZE != next->pgoff))
+		return -1;
+	
+	if (seg->shared != NULL) {
+		if ((shared = kmalloc((seg->size + next->size) / PAGE_SIZE * sizeof(page_t *))) == NULL)
 			return -1;
+		memcpy(shared, seg->shared, seg->size / PAGE_SIZE * sizeof(page_t *));
+		memcpy(shared + seg->size / PAGE_SIZE, next->shared, next->size / PAGE_SIZE * sizeof(page_t *));
+		kfree(seg->shared);
+		kfree(next->shared);
+		seg->shared = shared;
+	}
+	
+	/* Join private page lists */
+	if ((page = next->pages) != NULL) {
+		while (page->next != NULL)
+			page = page->next;
+		page->next = seg->pages;
+		if (seg->pages != NULL)
+			seg->pages->prev = page;
+		seg->pages = next->pages;
+	}
+	seg->size += next->size;
+	
+	for (k = idx; k < map->nsegs - 1; k++)
+		map->segs[k] = map->segs[k + 1];
+	map->nsegs--;
+	
+	cache_free(seg_cache, next);
+	return 0;
+}
+
+
+/* Function removes segment from memory map, unmaps and releases it */
+void seg_unmap(vm_map_t *map, vm_seg_t *seg)
+{
+	uint_t idx, k;
+	
+	idx = seg_search(map, seg->vaddr);
+	if ((idx == 0) || (map->segs[idx - 1] != seg))
+		return;
+	
+	for (k = idx - 1; k < map->nsegs - 1; k++)
+		map->segs[k] = map->segs[k + 1];
+	map->nsegs--;
+	
+	pmap_unmap_range(map->pmap, seg->vaddr, seg->size);
+	seg_free(seg);
+	return;
+}
+
+
+/*
+ * Function moves end of heap by incr bytes rounded to pages and returns
+ * previous end of heap. Heap pages are allocated on first access, shrinking
+ * heap releases pages above new end.
+ */
+void *map_sbrk(vm_map_t *map, int incr)
+{
+	vm_seg_t *seg = map->heap, *upper;
+	uint_t size, idx, n;
+	void *end, *limit;
+	
+	if (map->heap_base == NULL)
+		return NULL;
+	
+	size = (seg != NULL) ? seg->size : 0;
+	end = map->heap_base + size;
+	
+	/*
+	 * Heap grows by whole pages and shrinks only by whole pages. Sizes are
+	 * rounded unsigned, so the largest increments can't overflow.
+	 */
+	if (incr > 0) {
+		n = ((uint_t)incr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+		
+		idx = seg_search(map, map->heap_base);
+		limit = (idx < map->nsegs) ? map->segs[idx]->vaddr : (void *)KERNEL_BASE;
+		if ((limit < end) || (n > (uint_t)(limit - end)))
+			return NULL;
+		
+		if (seg != NULL) {
+			seg->size += n;
+			return end;
+		}
+		
+		seg = seg_create(NULL, map->heap_base, n, PGHD_PRESENT | PGHD_WRITE | PGHD_READ | PGHD_NOEXEC | PGHD_USER);
+		if ((seg == NULL) || (seg_map(map, seg) < 0))
+			return NULL;
+		map->heap = seg;
+	}
+	
+	else if (incr < 0) {
+		if ((n = (0 - (uint_t)incr) & ~(PAGE_SIZE - 1)) > size)
+			return NULL;
+		if ((seg == NULL) || !n)
+			return end;
+		
+		if (n == size) {
+			seg_unmap(map, seg);
+			map->heap = NULL;
+		}
+		else {
+			if ((upper = seg_split(map, seg, end - n)) == NULL)
+				return NULL;
+			seg_unmap(map, upper);
+		}
+	}
+	return end;
+}
+
+
+/* Function adds page to segment and maps it at vaddr */
+int seg_mappage(vm_map_t *map, vm_seg_t *seg, page_t *page, void *vaddr)
+{
+	if (pmap_map(map->pmap, page, vaddr, seg->flags) < 0)
+		return -1;
+	
+	page->prev = NULL;
+	page->next = seg->pages;
+	if (seg->pages != NULL)
+		seg->pages->prev = page;
+	seg->pages = page;
 	return 0;
 }
 
 
+/* Function adds reference to shared page */
+void page_ref(page_t *page)
+{
+	uint_t eflags;
+	
+	eflags = cli_save();
+	lock(&refs_mutex);
+	page->refs++;
+	unlock(&refs_mutex);
+	restore_flags(eflags);
+	return;
+}
+
+
+/* Function drops reference to shared page, unreferenced page is released */
+void page_unref(page_t *page)
+{
+	uint_t refs, eflags;
+	
+	eflags = cli_save();
+	lock(&refs_mutex);
+	refs = --page->refs;
+	unlock(&refs_mutex);
+	restore_flags(eflags);
+	
+	if (!refs)
+		area_free(page);
+	return;
+}
+
+
 /* Function releases task segments */
 void release_segs(vm_map_t *map)
 {
-	vm_seg_t *lseg, *seg;
+	uint_t k;
 	
-	lseg = NULL;	
-	for (seg = map->segs; seg != NULL; seg = seg->next) {
-		if (lseg != NULL)
-			kfree(lseg);
-		area_free(seg->pages);
-		lseg = seg;
+	for (k = 0; k < map->nsegs; k++) {
+		pmap_unmap_range(map->pmap, map->segs[k]->vaddr, map->segs[k]->size);
+		seg_free(map->segs[k]);
 	}
 	
-	if (lseg)
-		kfree(lseg);
+	if (map->segs != NULL)
+		kfree(map->segs);
+	map->segs = NULL;
+	map->nsegs = 0;
+	map->maxsegs = 0;
+	map->heap = NULL;
 	return;
 }
 
 
+/* Function returns size of kernel memory used by memory map, page tables excluded */
+uint_t map_kmem(vm_map_t *map)
+{
+	uint_t k, size;
+	
+	/* Page directory, map descriptor, segment table and segment descriptors */
+	size = PAGE_SIZE + sizeof(vm_map_t) + map->maxsegs * sizeof(vm_seg_t *) + map->nsegs * sizeof(vm_seg_t);
+	
+	for (k = 0; k < map->nsegs; k++) {
+		if (map->segs[k]->shared != NULL)
+			size += map->segs[k]->size / PAGE_SIZE * sizeof(page_t *);
+	}
+	return size;
+}
+
+
 /* Functions releases virtual memory map */
 void map_free(vm_map_t *map)
 {
 	release_segs(map);
 	pmap_free(map->pmap);
-	kfree(map);
+	cache_free(map_cache, map);
 	return;
 }
+
+
+/* Function initializes object caches used by VM subsystem */
+int vm_init(void)
+{
+	unlock(&refs_mutex);
+	
+	if ((map_cache = cache_create(sizeof(vm_map_t), 32, NULL, NULL)) == NULL)
+		return -1;
+	
+	if ((seg_cache = cache_create(sizeof(vm_seg_t), 128, NULL, NULL)) == NULL)
+		return -1;
+	
+	return pmap_initcaches();
+}
@@ -34,47 +34,124 @@
 #define DMA_MEM     0  /* DMA memory allocation flag */
 #define REG_MEM     1  /* Regular memory allocation flag */
 #define KERNEL_MEM  2  /* Kernel memory allocation flag */
+#define AREA_ZERO   0x100  /* Area pages are zeroed, pre-zeroed pages are preferred */
+
+
+/*
+ * Number of buddy allocator orders. The largest free block has 2^(MAX_ORDER - 1)
+ * pages (4 MB on IA32). Blocks are aligned to their size, so they never cross
+ * the 16 MB DMA boundary.
+ */
+#define MAX_ORDER   11
+
+
+/* Physical memory zones */
+#define ZONE_DMA     0  /* memory usable for DMA (below 16 MB) */
+#define ZONE_NORMAL  1  /* rest of physical memory */
+#define NZONES       2
+
+
+/* Part of free DMA memory (1/DMA_RESERVE) which isn't used by regular and kernel allocations */
+#define DMA_RESERVE  8
+
+/* Maximum number of pre-zeroed pages, pool isn't filled when less than 4 * ZEROPOOL_MAX pages are free */
+#define ZEROPOOL_MAX 256
+
+/* Number of area_alloc() latency buckets, bucket k counts calls shorter than 512 << k cycles */
+#define MEMSTATS_NLAT 12
+
+/* Latency of every MEMSTATS_SAMPLE-th call is measured, reading TSC costs tens of cycles */
+#define MEMSTATS_SAMPLE 16
+
+
+/*
+ * Zone of physical memory with its own free lists, counters and lock. Zone
+ * and zero pool locks are held with interrupts disabled - their owner may be
+ * the idle priority zero thread, which wouldn't be scheduled again while
+ * allocating task spins on the lock.
+ */
+typedef struct _zone_t {
+	mutex_t mutex;            /* zone access mutex */
+	uint_t start;             /* index of the first zone page */
+	uint_t size;              /* number of zone pages */
+	uint_t total_free;        /* number of free pages */
+	uint_t reserve;           /* free pages unavailable for fallback allocations */
+	page_t *free[MAX_ORDER];  /* circular lists of free buddy blocks */
+} zone_t;
 
 
 /* Structure defines linear memory map describing all pages */
 typedef struct _mem_map_t {
-	mutex_t mutex;         /* access mutex */
 	uint_t size;           /* number of pages available in the system */
 	page_t *first_page;    /* first page descriptor */
-	uint_t total_free;     /* memory statistics... */
-  uint_t kernel_mem;
-	uint_t dma_free;
+	zone_t zones[NZONES];  /* physical memory zones */
+  uint_t kernel_mem;     /* memory statistics... */
+	mutex_t zmutex;        /* protects pool of pre-zeroed pages */
+	page_t *zeroed;        /* pre-zeroed free pages (normal zone) */
+	uint_t nzeroed;        /* number of pre-zeroed pages */
+	uint_t tsc;            /* area_alloc() latency is measured */
+	uint_t ncalls;         /* area_alloc() calls, used for latency sampling */
+	uint_t failed[3];      /* failed allocations by class */
+	uint_t latency[MEMSTATS_NLAT];
 }	mem_map_t;
 
 
+/* Allocator statistics, largest run is the largest free block usable by coherent allocation */
+typedef struct _memstats_t {
+	uint_t free[NZONES];               /* free pages */
+	uint_t blocks[NZONES][MAX_ORDER];  /* free blocks of each order */
+	uint_t largest[NZONES];            /* largest free run in pages */
+	uint_t failed[3];                  /* failed DMA, regular and kernel allocations */
+	uint_t latency[MEMSTATS_NLAT];     /* sampled area_alloc() latency histogram */
+} memstats_t;
+
+
 /* Memory info structure (used in system call) */
 typedef struct _meminfo_t {
 	uint_t total;              /* physical memory size */
 	uint_t total_free;         /* free memory */
   uint_t kernel_rsvd;        /* kernel reserved memory */
 	uint_t dma_free;           /* free memory available for DMA */
+	uint_t kmalloc;            /* memory held by kmalloc areas */
 }	meminfo_t;
 
 
-/* Structure describes segment of process virtual space */
+/* Page fault attributes */
+#define VM_FAULT_WRITE  0x01  /* fault caused by write access */
+#define VM_FAULT_PROT   0x02  /* page is present, access violates its protection */
+
+
+/*
+ * Structure describes segment of process virtual space. Pages which aren't
+ * on the pages list are allocated on first access. Segment may be backed
+ * by a segment of the executable image (source) starting at its page pgoff -
+ * image pages are mapped shared and referenced in the shared table, writable
+ * ones are copied on write. Pages without file data are zeroed.
+ */
 typedef struct _vm_seg_t {
 	uint_t flags;            /* protection attributes */
 	void *vaddr;             /* starting virtual address */
 	uint_t size;             /* segment size */
-	page_t *pages;           /* area pages */
-	struct _vm_seg_t *next;
-	struct _vm_seg_t *prev;
+	page_t *pages;           /* private pages */
+	void *source;            /* image segment backing segment, NULL for anonymous segment */
+	uint_t pgoff;            /* index of the first segment page in source */
+	page_t **shared;         /* image pages mapped by segment */
 } vm_seg_t;
 
 
 /* Memory map of tasks virtual memory */
 typedef struct _vm_map_t {
 	pmap_t *pmap;            /* on-levele page table implemented by pmap interface */
-	vm_seg_t *segs;          /* task memory segments - double linked list */
+	vm_seg_t **segs;         /* task memory segments sorted by address */
+	uint_t nsegs;            /* number of segments */
+	uint_t maxsegs;          /* size of segs table */
+	void *image;             /* executable image mapped by task */
+	void *heap_base;         /* start of heap, NULL when heap can't be grown */
+	vm_seg_t *heap;          /* anonymous heap segment, NULL when heap is empty */
 } vm_map_t;
 
 
-/* Function creates memory map obtaining description from pmap_get_page() */
+/* Function creates memory map obtaining description from pmap_getrange() */
 extern void init_mem_map(uint_t size);
 
 
@@ -86,10 +163,21 @@ extern page_t *area_alloc(uint_t size, uint_t dest);
 extern void area_free(page_t *page);
 
 
+/*
+ * Function zeroes up to n free pages and puts them to the pool of pre-zeroed
+ * pages. It returns number of added pages, 0 when pool is full.
+ */
+extern uint_t zeropool_fill(uint_t n);
+
+
 /* Function prints memory usage statistics */
 extern void disp_meminfo(void);
 
 
+/* Function returns allocator statistics (PSC) */
+extern void get_memstats(memstats_t *ms);
+
+
 /* Function returns memory usage statistics (PSC) */
 extern void get_meminfo(meminfo_t *mi);
 
@@ -113,18 +201,78 @@ static inline void *kernel_pages_alloc(uint_t n)
 extern void kernel_pages_free(void *addr);
 
 
+/* Global memory map */
+extern mem_map_t mem_map;
+
+
+/* Inline function which returns descriptor of kernel page at addr */
+static inline page_t *kernel_page(void *addr)
+{
+	return mem_map.first_page + (uint_t)(addr - (void *)KERNEL_BASE) / PAGE_SIZE;
+}
+
+
 /* Function creates virtual memory map */
 extern vm_map_t *map_create(void);
 
 
-/* Function creates virtual memory segment */
-extern vm_seg_t *seg_create(page_t *pages, void *vaddr, uint_t flags);
+/*
+ * Function creates virtual memory segment of size bytes. Missing pages
+ * (all when pages is NULL) are allocated on first access.
+ */
+extern vm_seg_t *seg_create(page_t *pages, void *vaddr, uint_t size, uint_t flags);
+
+
+/* Function releases segment which isn't mapped */
+extern void seg_free(vm_seg_t *seg);
 
 
-/* Function maps segment to tasks virtual space */
+/*
+ * Function maps segment to tasks virtual space. Segment overlapping
+ * already mapped one is rejected and released.
+ */
 extern int seg_map(vm_map_t *map, vm_seg_t *seg);
 
 
+/* Function returns segment containing vaddr */
+extern vm_seg_t *seg_find(vm_map_t *map, void *vaddr);
+
+
+/* Function splits segment at vaddr and returns its upper part */
+extern vm_seg_t *seg_split(vm_map_t *map, vm_seg_t *seg, void *vaddr);
+
+
+/* Function merges segment with the following one if they are compatible */
+extern int seg_merge(vm_map_t *map, vm_seg_t *seg);
+
+
+/* Function removes segment from memory map, unmaps and releases it */
+extern void seg_unmap(vm_map_t *map, vm_seg_t *seg);
+
+
+/*
+ * Function moves end of heap by incr bytes rounded to pages and returns
+ * previous end of heap or NULL on error
+ */
+extern void *map_sbrk(vm_map_t *map, int incr);
+
+
+/* Function returns size of kernel memory used by memory map, page tables excluded */
+extern uint_t map_kmem(vm_map_t *map);
+
+
+/* Function adds page to segment and maps it at vaddr */
+extern int seg_mappage(vm_map_t *map, vm_seg_t *seg, page_t *page, void *vaddr);
+
+
+/* Function adds reference to shared page */
+extern void page_ref(page_t *page);
+
+
+/* Function drops reference to shared page, unreferenced page is released */
+extern void page_unref(page_t *page);
+
+
 /* Function releases task segments */
 extern void release_segs(vm_map_t *map);
 
@@ -133,4 +281,8 @@ extern void release_segs(vm_map_t *map);
 extern void map_free(vm_map_t *map);
 
 
+/* Function initializes object caches used by VM subsystem */
+extern int vm_init(void);
+
+
 #endif
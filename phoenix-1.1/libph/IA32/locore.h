@@ -301,6 +301,133 @@ static inline void __hal_inject(void *addr, u8 mask, u8 op)
 }
 
 
+static inline int __shmcreate(char *name, uint_t size)
+{
+	int id;
+	
+	__asm__ volatile
+	(" \
+		movl $0x11, %%edx; \
+		movl %0, %%eax; \
+		movl %1, %%ebx; \
+		movl %2, %%ecx; \
+		int $0x80"
+	:
+	:"m" (name), "g" (size), "g" (&id)
+	:"eax", "ebx", "ecx", "edx", "memory");
+	
+	return id;
+}
+
+
+static inline int __shmattach(int id, void *vaddr, uint_t attr)
+{
+	int err;
+	
+	__asm__ volatile
+	(" \
+		movl $0x12, %%edx; \
+		movl %0, %%eax; \
+		movl %1, %%ebx; \
+		movl %2, %%ecx; \
+		movl %3, %%edi; \
+		int $0x80"
+	:
+	:"g" (id), "g" (vaddr), "g" (attr), "g" (&err)
+	:"eax", "ebx", "ecx", "edx", "edi", "memory");
+	
+	return err;
+}
+
+
+static inline int __shmdetach(void *vaddr)
+{
+	int err;
+	
+	__asm__ volatile
+	(" \
+		movl $0x13, %%edx; \
+		movl %0, %%eax; \
+		movl %1, %%ebx; \
+		int $0x80"
+	:
+	:"g" (vaddr), "g" (&err)
+	:"eax", "ebx", "edx", "memory");
+	
+	return err;
+}
+
+
+static inline int __shmremove(int id)
+{
+	int err;
+	
+	__asm__ volatile
+	(" \
+		movl $0x14, %%edx; \
+		movl %0, %%eax; \
+		movl %1, %%ebx; \
+		int $0x80"
+	:
+	:"g" (id), "g" (&err)
+	:"eax", "ebx", "edx", "memory");
+	
+	return err;
+}
+
+
+static inline void *__sbrk(int incr)
+{
+	void *addr;
+	
+	__asm__ volatile
+	(" \
+		movl $0x15, %%edx; \
+		movl %0, %%eax; \
+		movl %1, %%ebx; \
+		int $0x80"
+	:
+	:"g" (incr), "g" (&addr)
+	:"eax", "ebx", "edx", "memory");
+	
+	return addr;
+}
+
+
+static inline void __getmemstats(memstats_t *ms)
+{
+	__asm__ volatile
+	(" \
+		movl $0x16, %%edx; \
+		movl %0, %%eax; \
+		int $0x80"
+	:
+	:"g" (ms)
+	:"eax", "edx", "memory");
+	
+	return;
+}
+
+
+static inline int __setpriority(uint_t pid, uint_t priority)
+{
+	int err;
+	
+	__asm__ volatile
+	(" \
+		movl $0x17, %%edx; \
+		movl %0, %%eax; \
+		movl %1, %%ebx; \
+		movl %2, %%ecx; \
+		int $0x80"
+	:
+	:"g" (pid), "g" (priority), "g" (&err)
+	:"eax", "ebx", "ecx", "edx", "memory");
+	
+	return err;
+}
+
+
 #endif
 
 
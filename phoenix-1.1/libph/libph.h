@@ -101,6 +101,12 @@ extern int ph_devread(dev_t *dev, char *buff, uint_t *pos, uint_t length);
 #define TASK_NAMESZ    32
 
 
+/* Task priorities, 0 is the highest one */
+#define NPRIORITIES       8
+#define PRIORITY_DEFAULT  4
+#define PRIORITY_IDLE     7
+
+
 typedef struct taskinfo {
 	uint_t id;
 	uint_t ppid;
@@ -109,6 +115,9 @@ typedef struct taskinfo {
 	uint_t state;
 	uint_t type;
 	char name[TASK_NAMESZ];
+	uint_t resident;
+	uint_t ptables;
+	uint_t kmem;
 } taskinfo_t;
 
 
@@ -117,17 +126,36 @@ typedef struct _meminfo_t {
 	uint_t total_free;
   uint_t kernel_rsvd;
 	uint_t dma_free;
+	uint_t kmalloc;
 }	meminfo_t;
 
 
+#define MEMSTATS_NZONES   2
+#define MEMSTATS_NORDERS  11
+#define MEMSTATS_NLAT     12
+
+
+typedef struct _memstats_t {
+	uint_t free[MEMSTATS_NZONES];
+	uint_t blocks[MEMSTATS_NZONES][MEMSTATS_NORDERS];
+	uint_t largest[MEMSTATS_NZONES];
+	uint_t failed[3];
+	uint_t latency[MEMSTATS_NLAT];
+} memstats_t;
+
+
 extern void ph_gettasks(uint_t *pids, uint_t length, uint_t *ntasks);
 
 extern int ph_gettaskinfo(uint_t pid, taskinfo_t *ti);
 
 extern void ph_getmeminfo(meminfo_t *mi);
 
+extern void ph_getmemstats(memstats_t *ms);
+
 extern int ph_raise(uint_t pid, uint_t sig);
 
+extern int ph_setpriority(uint_t pid, uint_t priority);
+
 extern int ph_exec(char *name);
 
 extern uint_t ph_wait(int *err);
@@ -141,4 +169,57 @@ extern void ph_sleep(uint_t delay);
 extern void ph_inject(void *addr, u8 mask, u8 op);
 
 
+/*
+ * Shared memory segments
+ */
+
+
+#define SHM_NAMESZ   32
+#define SHM_MAXSIZE  0x400000
+
+#define SHM_WRITE    0x01
+
+
+extern int ph_shmcreate(char *name, uint_t size);
+
+extern int ph_shmattach(int id, void *vaddr, uint_t attr);
+
+extern int ph_shmdetach(void *vaddr);
+
+extern int ph_shmremove(int id);
+
+
+/*
+ * Dynamic memory
+ */
+
+
+#define PH_PAGESZ     4096
+#define PH_NCLASSES   8      /* size classes 16, 32, ... 2048 bytes */
+
+
+/*
+ * Arena holds free lists of size classes and page runs it obtained from the
+ * common page pool. Allocator state is kept only in arena, so each thread can
+ * get own arena. All arena blocks can be released at once by ph_arenafree().
+ */
+typedef struct _ph_arena_t {
+	void *free[PH_NCLASSES];
+	void *chunks;
+} ph_arena_t;
+
+
+extern void *ph_sbrk(int incr);
+
+extern void ph_arenainit(ph_arena_t *arena);
+
+extern void *ph_arenaalloc(ph_arena_t *arena, uint_t size);
+
+extern void ph_arenafree(ph_arena_t *arena);
+
+extern void *ph_malloc(uint_t size);
+
+extern void ph_free(void *p);
+
+
 #endif
@@ -0,0 +1,243 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Standard library
+ *
+ * Dynamic memory allocator
+ *
+ * Copyright 2005 Pawel Pisarczyk
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * Phoenix-RTOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Phoenix-RTOS kernel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Phoenix-RTOS kernel; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <libph.h>
+
+
+/* Size class of chunk holding single large block */
+#define CHUNK_LARGE   PH_NCLASSES
+
+/* Smallest size class and minimal size of free top of heap returned to kernel */
+#define CLASS_MIN     16
+#define TRIM_PAGES    16
+
+
+/* Header at the beginning of every page run owned by arena */
+typedef struct _chunk_t {
+	struct _chunk_t *next;
+	struct _chunk_t *prev;
+	ph_arena_t *arena;
+	uint_t npages;
+	uint_t class;
+} chunk_t;
+
+#define CHUNK_HDRSZ   ((sizeof(chunk_t) + CLASS_MIN - 1) & ~(CLASS_MIN - 1))
+
+
+/* Free page run in common page pool */
+typedef struct _run_t {
+	struct _run_t *next;
+	uint_t npages;
+} run_t;
+
+
+/* Page pool shared by arenas, runs are sorted by address and coalesced */
+static run_t *pool;
+static void *heap_top;
+
+static ph_arena_t arena_default;
+
+
+/* Function takes n pages from pool, missing pages are obtained from kernel */
+static void *pages_alloc(uint_t n)
+{
+	run_t *run, **prev;
+	void *p;
+	
+	for (prev = &pool; (run = *prev) != NULL; prev = &run->next) {
+		if (run->npages < n)
+			continue;
+		
+		/* Pages are taken from the end of run, so run stays in place */
+		if ((run->npages -= n) == 0)
+			*prev = run->next;
+		return (void *)run + run->npages * PH_PAGESZ;
+	}
+	
+	if ((p = ph_sbrk(n * PH_PAGESZ)) == NULL)
+		return NULL;
+	heap_top = p + n * PH_PAGESZ;
+	return p;
+}
+
+
+/* Function returns n pages to pool, free top of heap is returned to kernel */
+static void pages_free(void *p, uint_t n)
+{
+	run_t *run = p, *before = NULL, *after;
+	
+	for (after = pool; (after != NULL) && ((void *)after < p); after = after->next)
+		before = after;
+	
+	run->npages = n;
+	run->next = after;
+	if (before != NULL)
+		before->next = run;
+	else
+		pool = run;
+	
+	/* Merge with following and preceding run */
+	if ((after != NULL) && ((void *)run + run->npages * PH_PAGESZ == (void *)after)) {
+		run->npages += after->npages;
+		run->next = after->next;
+	}
+	if ((before != NULL) && ((void *)before + before->npages * PH_PAGESZ == (void *)run)) {
+		before->npages += run->npages;
+		before->next = run->next;
+		run = before;
+	}
+	
+	/* Heap is shrunk only when nobody else moved its end */
+	if ((run->next != NULL) || (run->npages < TRIM_PAGES) ||
+	    ((void *)run + run->npages * PH_PAGESZ != heap_top) || (ph_sbrk(0) != heap_top))
+		return;
+	
+	if (ph_sbrk(-(int)(run->npages * PH_PAGESZ)) == NULL)
+		return;
+	heap_top = run;
+	
+	if (pool == run)
+		pool = NULL;
+	else {
+		for (before = pool; before->next != run; before = before->next)
+			;
+		before->next = NULL;
+	}
+	return;
+}
+
+
+/* Function adds page run to arena */
+static chunk_t *chunk_alloc(ph_arena_t *arena, uint_t npages, uint_t class)
+{
+	chunk_t *chunk;
+	
+	if ((chunk = pages_alloc(npages)) == NULL)
+		return NULL;
+	
+	chunk->arena = arena;
+	chunk->npages = npages;
+	chunk->class = class;
+	chunk->prev = NULL;
+	chunk->next = arena->chunks;
+	if (chunk->next != NULL)
+		chunk->next->prev = chunk;
+	arena->chunks = chunk;
+	return chunk;
+}
+
+
+void ph_arenainit(ph_arena_t *arena)
+{
+	uint_t k;
+	
+	for (k = 0; k < PH_NCLASSES; k++)
+		arena->free[k] = NULL;
+	arena->chunks = NULL;
+	return;
+}
+
+
+void *ph_arenaalloc(ph_arena_t *arena, uint_t size)
+{
+	uint_t class, bsize;
+	chunk_t *chunk;
+	void *b;
+	
+	for (class = 0, bsize = CLASS_MIN; (class < PH_NCLASSES) && (bsize < size); class++)
+		bsize <<= 1;
+	
+	/* Large block occupies own page run */
+	if (class == PH_NCLASSES) {
+		if (size > (uint_t)-PH_PAGESZ - CHUNK_HDRSZ)
+			return NULL;
+		if ((chunk = chunk_alloc(arena, (size + CHUNK_HDRSZ + PH_PAGESZ - 1) / PH_PAGESZ, CHUNK_LARGE)) == NULL)
+			return NULL;
+		return (void *)chunk + CHUNK_HDRSZ;
+	}
+	
+	/* Empty size class is refilled with whole page */
+	if (arena->free[class] == NULL) {
+		if ((chunk = chunk_alloc(arena, 1, class)) == NULL)
+			return NULL;
+		for (b = (void *)chunk + CHUNK_HDRSZ; b + bsize <= (void *)chunk + PH_PAGESZ; b += bsize) {
+			*(void **)b = arena->free[class];
+			arena->free[class] = b;
+		}
+	}
+	
+	b = arena->free[class];
+	arena->free[class] = *(void **)b;
+	return b;
+}
+
+
+void ph_arenafree(ph_arena_t *arena)
+{
+	chunk_t *chunk, *next;
+	
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		pages_free(chunk, chunk->npages);
+	}
+	ph_arenainit(arena);
+	return;
+}
+
+
+void *ph_malloc(uint_t size)
+{
+	return ph_arenaalloc(&arena_default, size);
+}
+
+
+void ph_free(void *p)
+{
+	chunk_t *chunk;
+	ph_arena_t *arena;
+	
+	if (p == NULL)
+		return;
+	
+	/* Block always starts in the first page of its chunk */
+	chunk = (chunk_t *)((uint_t)p & ~(PH_PAGESZ - 1));
+	arena = chunk->arena;
+	
+	if (chunk->class != CHUNK_LARGE) {
+		*(void **)p = arena->free[chunk->class];
+		arena->free[chunk->class] = p;
+		return;
+	}
+	
+	if (chunk->prev != NULL)
+		chunk->prev->next = chunk->next;
+	else
+		arena->chunks = chunk->next;
+	if (chunk->next != NULL)
+		chunk->next->prev = chunk->prev;
+	pages_free(chunk, chunk->npages);
+	return;
+}
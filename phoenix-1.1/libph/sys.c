@@ -49,12 +49,25 @@ void ph_getmeminfo(meminfo_t *mi)
 }
 
 
+void ph_getmemstats(memstats_t *ms)
+{
+	__getmemstats(ms);
+	return;
+}
+
+
 int ph_raise(uint_t pid, uint_t sig)
 {
 	return __raise(pid, sig);
 }
 
 
+int ph_setpriority(uint_t pid, uint_t priority)
+{
+	return __setpriority(pid, priority);
+}
+
+
 int ph_exec(char *name)
 {
 	return __exec(name);
@@ -90,3 +103,33 @@ void ph_inject(void *addr, u8 mask, u8 op)
 {
 	return __hal_inject(addr, mask, op);
 }
+
+
+int ph_shmcreate(char *name, uint_t size)
+{
+	return __shmcreate(name, size);
+}
+
+
+int ph_shmattach(int id, void *vaddr, uint_t attr)
+{
+	return __shmattach(id, vaddr, attr);
+}
+
+
+int ph_shmdetach(void *vaddr)
+{
+	return __shmdetach(vaddr);
+}
+
+
+int ph_shmremove(int id)
+{
+	return __shmremove(id);
+}
+
+
+void *ph_sbrk(int incr)
+{
+	return __sbrk(incr);
+}
@@ -29,6 +29,7 @@
 
 #define PROMPT_SIZE       1024
 
+#define min(a, b) (a < b ? a : b)
 #define max(a, b) (a > b ? a : b)
 
 
@@ -36,20 +37,32 @@
 void do_ps(char *line, uint_t *lpos, char *word, uint_t word_size)
 {
 	char *states[] = { "run", "slp", "rdy", "strt", "cwt", "zmb" };
-	uint_t pids[1024];
-	uint_t ntasks, k;
+	uint_t *pids, length, ntasks, k;
 	taskinfo_t ti;
 	
-	ph_printf("%4s %10s %5s %5s %6s\n", "PID", "NAME", "STATE", "PRTY", "PPID"); 
-	ph_gettasks(pids, 128, &ntasks);
+	/* Identifier table is sized to the number of tasks, tasks can be created in meantime */
+	ph_gettasks(NULL, 0, &length);
+	length += 16;
+	if ((pids = ph_malloc(length * sizeof(uint_t))) == NULL) {
+		ph_printf("ps: out of memory\n");
+		return;
+	}
+	ph_gettasks(pids, length, &ntasks);
+	ntasks = min(ntasks, length);
 	
+	/* Memory columns are given in KB: resident pages, page tables and kernel structures */
+	ph_printf("%4s %10s %5s %5s %6s %6s %5s %5s\n", "PID", "NAME", "STATE", "PRTY", "PPID", "RSS", "PTBL", "KMEM"); 
 	for (k = 0; k < ntasks; k++) {
-		ph_gettaskinfo(pids[ntasks - k - 1], &ti);
+		if (ph_gettaskinfo(pids[ntasks - k - 1], &ti) < 0)
+			continue;
 		if (ti.type)
-			ph_printf("%4d %10s %5s %5d %6d\n", ti.id, ti.name, states[ti.state], ti.priority, ti.ppid);
+			ph_printf("%4d %10s %5s %5d %6d %6d %5d %5d\n", ti.id, ti.name, states[ti.state], ti.priority, ti.ppid,
+			          ti.resident / 1024, ti.ptables / 1024, ti.kmem / 1024);
 		else
-			ph_printf("%4d %9s+ %5s %5d %6d\n", ti.id, ti.name, states[ti.state], ti.priority, ti.ppid);
+			ph_printf("%4d %9s+ %5s %5d %6d %6d %5d %5d\n", ti.id, ti.name, states[ti.state], ti.priority, ti.ppid,
+			          ti.resident / 1024, ti.ptables / 1024, ti.kmem / 1024);
 	}
+	ph_free(pids);
 	return;
 }
 
@@ -59,9 +72,40 @@ void do_mi(char *line, uint_t *lpos, char *word, uint_t word_size)
 {
 	meminfo_t mi;
 	
-	ph_printf("%10s %10s %10s %10s\n", "TOTAL", "KRNL_RSVD", "DMA_FREE", "FREE"); 
+	ph_printf("%10s %10s %10s %10s %10s\n", "TOTAL", "KRNL_RSVD", "DMA_FREE", "FREE", "KMALLOC"); 
 	ph_getmeminfo(&mi);
-	ph_printf("%10d %10d %10d %10d\n", mi.total >> 10, mi.kernel_rsvd >> 10, mi.dma_free >> 10, mi.total_free >> 10);
+	ph_printf("%10d %10d %10d %10d %10d\n", mi.total >> 10, mi.kernel_rsvd >> 10, mi.dma_free >> 10,
+	          mi.total_free >> 10, mi.kmalloc >> 10);
+	return;
+}
+
+
+/* Function prints free block histogram, allocation failures and allocation latency */
+void do_ms(char *line, uint_t *lpos, char *word, uint_t word_size)
+{
+	char *zones[] = { "dma", "normal" };
+	char *classes[] = { "dma", "regular", "kernel" };
+	memstats_t ms;
+	uint_t k, order;
+	
+	ph_getmemstats(&ms);
+	
+	ph_printf("%6s %8s %8s  free blocks of order 0-%d\n", "ZONE", "FREE", "LARGEST", MEMSTATS_NORDERS - 1);
+	for (k = 0; k < MEMSTATS_NZONES; k++) {
+		ph_printf("%6s %8d %8d ", zones[k], ms.free[k] * 4, ms.largest[k] * 4);
+		for (order = 0; order < MEMSTATS_NORDERS; order++)
+			ph_printf(" %d", ms.blocks[k][order]);
+		ph_printf("\n");
+	}
+	
+	ph_printf("failed allocations:");
+	for (k = 0; k < 3; k++)
+		ph_printf(" %s %d", classes[k], ms.failed[k]);
+	
+	ph_printf("\narea_alloc cycles:");
+	for (k = 0; k < MEMSTATS_NLAT - 1; k++)
+		ph_printf(" <%d:%d", 512 << k, ms.latency[k]);
+	ph_printf(" more:%d\n", ms.latency[k]);
 	return;
 }
 
@@ -175,6 +219,7 @@ struct {
 cmnds[] = {
 	{ "ps", &do_ps },
 	{ "mi", &do_mi },
+	{ "ms", &do_ms },
 	{ "raise", &do_raise },
 	{ "help", &do_help },
 	{ "exit", &do_exit },
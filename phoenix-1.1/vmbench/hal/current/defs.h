@@ -0,0 +1,64 @@
+/*
+ * Phoenix-RTOS
+ *
+ * vmbench - host benchmark of kernel memory allocators
+ *
+ * Host replacement of architecture definitions
+ *
+ * Copyright 2001 Pawel Pisarczyk
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * Phoenix-RTOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Phoenix-RTOS kernel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Phoenix-RTOS kernel; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _DEFS_H_
+#define _DEFS_H_
+
+
+/* Paging parameters */
+#define PAGE_SIZE               0x1000      /* page size - 4KB */
+#define PAGE_DIR_SIZE           0x0400      /* number of entries in page directory */
+#define PAGE_TABLE_SIZE         0x0400      /* number of entries in page table */
+
+
+#define NCPUS                   1           /* number of supported processors */
+
+
+/* CPU features reported by cpu_features() */
+#define CPUID_TSC               0x00000010  /* time stamp counter */
+
+
+/*
+ * Simulated physical memory is a host array, so kernel space starts at
+ * its address instead of 0xc0000000.
+ */
+extern unsigned long sim_base;
+
+#define KERNEL_BASE             sim_base    /* base virtual address of kernel space */
+#define KERNEL_BSS_END          0x100000    /* begin of kernel heap */
+
+
+/* Address conversion macros */
+#define PHYS_TO_KERNEL(a) ((void *)(unsigned long)(a) + KERNEL_BASE)
+#define KERNEL_TO_PHYS(a) ((void *)(a) - KERNEL_BASE)
+
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+
+#endif
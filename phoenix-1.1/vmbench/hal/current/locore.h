@@ -0,0 +1,107 @@
+/*
+ * Phoenix-RTOS
+ *
+ * vmbench - host benchmark of kernel memory allocators
+ *
+ * Host replacement of low level routines
+ *
+ * Copyright 2001 Pawel Pisarczyk
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * Phoenix-RTOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Phoenix-RTOS kernel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Phoenix-RTOS kernel; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _LOCORE_H
+#define _LOCORE_H
+
+#include <string.h>
+#include <hal/current/types.h>
+#include <hal/current/defs.h>
+
+
+/*
+ * Benchmark is single threaded, so mutexes and interrupt control are
+ * reduced to no-ops. Mutex state is still updated to keep the cost of
+ * the memory access.
+ */
+
+
+static inline void memclr(void *where, uint_t n)
+{
+	__builtin_memset(where, 0, n);
+}
+
+
+static inline void lock(mutex_t *mutex)
+{
+	*mutex = 0;
+}
+
+
+static inline void unlock(mutex_t *mutex)
+{
+	*mutex = 1;
+}
+
+
+static inline void sti(void)
+{
+}
+
+
+static inline void cli(void)
+{
+}
+
+
+static inline uint_t cli_save(void)
+{
+	return 0x200;
+}
+
+
+static inline void restore_flags(uint_t eflags)
+{
+}
+
+
+static inline uint_t cpu_id(void)
+{
+	return 0;
+}
+
+
+static inline uint_t cpu_features(void)
+{
+	return CPUID_TSC;
+}
+
+
+static inline uint_t get_cycles(void)
+{
+	return (uint_t)__builtin_ia32_rdtsc();
+}
+
+
+/* Macro locks interrupts and mutex */
+#define lock_cli(m) { cli(); lock(m); }
+
+
+/* Macro releases mutex and interrupts */
+#define unlock_sti(m) { unlock(m); sti(); }
+
+
+#endif
@@ -0,0 +1,304 @@
+/*
+ * Phoenix-RTOS
+ *
+ * vmbench - host benchmark of kernel memory allocators
+ *
+ * Simulated physical memory and pmap interface
+ *
+ * Copyright 2001 Pawel Pisarczyk
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * Phoenix-RTOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Phoenix-RTOS kernel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Phoenix-RTOS kernel; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include <hal/current/types.h>
+#include <hal/current/defs.h>
+#include <hal/current/locore.h>
+#include <hal/current/pmap.h>
+#include <vm/vm.h>
+#include <vm/cache.h>
+
+#include "vmbench.h"
+
+
+/* Host address of simulated physical memory */
+unsigned long sim_base;
+
+
+/* Top of statically allocated kernel memory */
+static uint_t kernel_mem_top = KERNEL_BSS_END;
+
+
+/* Cache of pmap structures */
+static cache_t *pmap_cache;
+
+
+pmap_stats_t pmap_stats;
+
+
+/* Simulated memory size and ISA hole presence */
+static uint_t sim_size;
+static int sim_hole;
+
+
+/*
+ * Function allocates simulated physical memory of given size. When hole is
+ * set, memory between 15 and 16 MB is reserved like ISA hole in BIOS map.
+ */
+int sim_init(uint_t size, int hole)
+{
+	void *mem;
+	
+	if (posix_memalign(&mem, PAGE_SIZE, size))
+		return -1;
+	
+	memset(mem, 0, size);
+	sim_base = (unsigned long)mem;
+	sim_size = size;
+	sim_hole = hole;
+	return 0;
+}
+
+
+/* Kernel console output goes to stdout */
+void std_printf(char *fmt, ...)
+{
+	va_list ap;
+	
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	return;
+}
+
+
+/*
+ * Function returns n-th range of physical memory. Layout is the same as
+ * seen by the kernel on a PC with BIOS memory map.
+ */
+int pmap_getrange(uint_t n, pmap_range_t *range)
+{
+	uint_t npages = sim_size / PAGE_SIZE;
+	uint_t top = (kernel_mem_top + npages * sizeof(page_t)) / PAGE_SIZE + 1;
+	uint_t hole = sim_hole && (npages > 0x1000) ? 0xf00 : 0x1000;
+	pmap_range_t ranges[] = {
+		{ 0, 0xa0, PG_RSVD | PG_KERNEL },
+		{ 0xa0, 0x101, PG_RSVD },
+		{ 0x101, top, PG_RSVD | PG_KERNEL },
+		{ top, hole, PG_PRESENT | PG_DMA },
+		{ hole, 0x1000, PG_RSVD },
+		{ 0x1000, npages, PG_PRESENT }
+	};
+	
+	if (n >= sizeof(ranges) / sizeof(ranges[0]))
+		return -1;
+	
+	*range = ranges[n];
+	return 0;
+}
+
+
+/* Function returns top of statically allocated kernel memory */
+uint_t pmap_get_kmem_top(void)
+{
+	return kernel_mem_top;
+}
+
+
+/* Function initializes pmap cache */
+int pmap_initcaches(void)
+{
+	if ((pmap_cache = cache_create(sizeof(pmap_t), 32, NULL, NULL)) == NULL)
+		return -1;
+	return 0;
+}
+
+
+/* Function creates empty page directory */
+pmap_t *pmap_create(void)
+{
+	pmap_t *pmap;
+	
+	if ((pmap = cache_alloc(pmap_cache)) == NULL)
+		return NULL;
+	
+	if ((pmap->pdir = kernel_pages_alloc(1)) == NULL) {
+		cache_free(pmap_cache, pmap);
+		return NULL;
+	}
+	
+	memclr(pmap->pdir, PAGE_SIZE);
+	pmap->npages = 0;
+	pmap->ntables = 0;
+	pmap_stats.pmaps++;
+	return pmap;
+}
+
+
+/* Function returns page table covering vaddr, missing one is allocated when alloc is set */
+static ptentry_t *pmap_getptable(pmap_t *pmap, uint_t va, int alloc)
+{
+	pdentry_t *pde = (pdentry_t *)pmap->pdir + va / PAGE_SIZE / PAGE_TABLE_SIZE;
+	ptentry_t *ptable;
+	page_t *page;
+	
+	if (*pde & PTHD_PRESENT)
+		return PHYS_TO_KERNEL(*pde & ~(PAGE_SIZE - 1));
+	
+	if (!alloc || ((page = area_alloc(1, KERNEL_MEM | AREA_ZERO)) == NULL))
+		return NULL;
+	
+	ptable = (ptentry_t *)(KERNEL_BASE + page->num * PAGE_SIZE);
+	page->refs = 0;
+	*pde = (pdentry_t)(unsigned long)KERNEL_TO_PHYS(ptable) | PTHD_PRESENT | PTHD_USER | PTHD_WRITE;
+	pmap->ntables++;
+	pmap_stats.ptables++;
+	return ptable;
+}
+
+
+/* Function sets page table entry, new entries are counted in page table page */
+static inline void pmap_setpte(pmap_t *pmap, ptentry_t *ptable, uint_t va, page_t *page, uint_t flags)
+{
+	ptentry_t *pte = &ptable[va / PAGE_SIZE % PAGE_TABLE_SIZE];
+	
+	if (!(*pte & PGHD_PRESENT)) {
+		kernel_page(ptable)->refs++;
+		pmap->npages++;
+		pmap_stats.mapped++;
+	}
+	*pte = page->num * PAGE_SIZE | flags | PGHD_PRESENT;
+	return;
+}
+
+
+/*
+ * Function maps page at vaddr. Page tables are taken from the page
+ * allocator, just like in the IA32 pmap.
+ */
+int pmap_map(pmap_t *pmap, page_t *page, void *vaddr, uint_t flags)
+{
+	uint_t va = (uint_t)(unsigned long)vaddr;
+	ptentry_t *ptable;
+	
+	if ((ptable = pmap_getptable(pmap, va, 1)) == NULL)
+		return -1;
+	
+	pmap_setpte(pmap, ptable, va, page, flags);
+	return 0;
+}
+
+
+/* Function maps page list at consecutive addresses, page table is looked up once per span */
+int pmap_map_range(pmap_t *pmap, page_t *pages, void *vaddr, uint_t flags)
+{
+	uint_t va = (uint_t)(unsigned long)vaddr;
+	ptentry_t *ptable;
+	page_t *p = pages;
+	
+	while (p != NULL) {
+		if ((ptable = pmap_getptable(pmap, va, 1)) == NULL)
+			return -1;
+		
+		do {
+			pmap_setpte(pmap, ptable, va, p, flags);
+			p = p->next;
+			va += PAGE_SIZE;
+		} while ((p != NULL) && (va / PAGE_SIZE % PAGE_TABLE_SIZE));
+	}
+	return 0;
+}
+
+
+/* Function unmaps size bytes from vaddr and releases empty page tables */
+void pmap_unmap_range(pmap_t *pmap, void *vaddr, uint_t size)
+{
+	uint_t va = (uint_t)(unsigned long)vaddr, end = va + size;
+	ptentry_t *ptable;
+	page_t *ptpage;
+	
+	while (va < end) {
+		if ((ptable = pmap_getptable(pmap, va, 0)) == NULL) {
+			va = (va / PAGE_SIZE / PAGE_TABLE_SIZE + 1) * PAGE_SIZE * PAGE_TABLE_SIZE;
+			continue;
+		}
+		ptpage = kernel_page(ptable);
+		
+		do {
+			if (ptable[va / PAGE_SIZE % PAGE_TABLE_SIZE] & PGHD_PRESENT) {
+				ptable[va / PAGE_SIZE % PAGE_TABLE_SIZE] = 0;
+				ptpage->refs--;
+				pmap->npages--;
+				pmap_stats.mapped--;
+			}
+			va += PAGE_SIZE;
+		} while ((va < end) && (va / PAGE_SIZE % PAGE_TABLE_SIZE));
+		
+		if (!ptpage->refs) {
+			((pdentry_t *)pmap->pdir)[(va - PAGE_SIZE) / PAGE_SIZE / PAGE_TABLE_SIZE] = 0;
+			kernel_pages_free(ptable);
+			pmap->ntables--;
+			pmap_stats.ptables--;
+		}
+	}
+	return;
+}
+
+
+/* Function returns number of physical page mapped at vaddr */
+int pmap_getpn(pmap_t *pmap, void *vaddr, uint_t *pn)
+{
+	uint_t va = (uint_t)(unsigned long)vaddr;
+	pdentry_t pde = ((pdentry_t *)pmap->pdir)[va / PAGE_SIZE / PAGE_TABLE_SIZE];
+	ptentry_t pte;
+	
+	if (!(pde & PTHD_PRESENT))
+		return -1;
+	
+	pte = ((ptentry_t *)PHYS_TO_KERNEL(pde & ~(PAGE_SIZE - 1)))[va / PAGE_SIZE % PAGE_TABLE_SIZE];
+	if (!(pte & PGHD_PRESENT))
+		return -1;
+	
+	*pn = pte / PAGE_SIZE;
+	return 0;
+}
+
+
+/* Function releases page tables and page directory */
+void pmap_free(pmap_t *pmap)
+{
+	pdentry_t *pdir = pmap->pdir;
+	uint_t k;
+	
+	for (k = 0; k < PAGE_DIR_SIZE; k++) {
+		if (pdir[k] & PTHD_PRESENT) {
+			kernel_page(PHYS_TO_KERNEL(pdir[k] & ~(PAGE_SIZE - 1)))->refs = 0;
+			kernel_pages_free(PHYS_TO_KERNEL(pdir[k] & ~(PAGE_SIZE - 1)));
+			pmap_stats.ptables--;
+		}
+	}
+	
+	kernel_pages_free(pmap->pdir);
+	pmap_stats.mapped -= pmap->npages;
+	pmap_stats.pmaps--;
+	cache_free(pmap_cache, pmap);
+	return;
+}
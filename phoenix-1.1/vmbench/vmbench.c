@@ -0,0 +1,886 @@
+/*
+ * Phoenix-RTOS
+ *
+ * vmbench - host benchmark of kernel memory allocators
+ *
+ * Trace generators, replay and reports
+ *
+ * Copyright 2001 Pawel Pisarczyk
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * Phoenix-RTOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Phoenix-RTOS kernel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Phoenix-RTOS kernel; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <hal/current/types.h>
+#include <hal/current/defs.h>
+#include <hal/current/pmap.h>
+#include <vm/vm.h>
+#include <vm/kmalloc.h>
+
+#include "vmbench.h"
+
+
+extern char *optarg;
+extern int optind;
+
+extern mem_map_t mem_map;
+
+
+/* Trace operations */
+#define OP_ALLOC     0   /* area_alloc(arg, dest) */
+#define OP_FREE      1   /* area_free() */
+#define OP_KMALLOC   2   /* kmalloc(arg) */
+#define OP_KFREE     3   /* kfree() */
+#define OP_EXEC      4   /* map with segments of arg pages, kernel stack and task */
+#define OP_EXIT      5   /* release of OP_EXEC and OP_MAP objects */
+#define OP_MAP       6   /* empty memory map */
+#define OP_SEG       7   /* segment of dest pages mapped at page arg */
+#define OP_FIND      8   /* lookup of segment containing page arg */
+#define OP_SPLIT     9   /* split of segment at page arg */
+#define OP_MERGE     10  /* merge of segment containing page arg with the next one */
+#define NOPS         11
+
+
+char *op_names[NOPS] = { "alloc", "free", "kmalloc", "kfree", "exec", "exit", "map", "seg", "find", "split", "merge" };
+char *dest_names[3] = { "dma", "reg", "kernel" };
+
+
+/* Number of object slots used by traces */
+#define NSLOTS       16384
+
+/* Fragmentation is sampled every SAMPLE_OPS operations */
+#define SAMPLE_OPS   1024
+
+/* Order used to compute unusable free space index (64 KB) */
+#define FRAG_ORDER   4
+
+/* Task structure size used by OP_EXEC */
+#define TASK_SIZE    384
+
+/* Number of segments in maps built by segs scenario */
+#define NSEGS        512
+
+
+/* Operation classes */
+#define IS_ALLOCOP(t)   (((t) == OP_ALLOC) || ((t) == OP_KMALLOC) || ((t) == OP_EXEC) || ((t) == OP_MAP))
+#define IS_RELEASEOP(t) (((t) == OP_FREE) || ((t) == OP_KFREE) || ((t) == OP_EXIT))
+
+
+/* Single trace operation */
+typedef struct _op_t {
+	uchar_t type;
+	uchar_t dest;
+	uint_t slot;
+	uint_t arg;
+} op_t;
+
+
+/* Trace - sequence of operations */
+typedef struct _trace_t {
+	char *name;
+	op_t *ops;
+	uint_t n;
+	uint_t size;
+} trace_t;
+
+
+/* Object allocated by trace */
+typedef struct _slot_t {
+	uint_t type;        /* operation which allocated object */
+	void *obj;          /* page list, kmalloc block or memory map */
+	void *kstack;       /* OP_EXEC kernel stack */
+	void *task;         /* OP_EXEC task structure */
+} slot_t;
+
+
+/* Latencies of one operation type */
+typedef struct _opstat_t {
+	uint_t n;
+	uint_t failed;
+	unsigned long long total;
+	unsigned long long *lat;
+} opstat_t;
+
+
+/* Fragmentation of free physical memory */
+typedef struct _frag_t {
+	uint_t free;                /* free pages */
+	uint_t blocks;              /* free buddy blocks */
+	uint_t max_order;           /* order of the largest free block */
+	uint_t unusable;            /* free pages in blocks smaller than FRAG_ORDER */
+} frag_t;
+
+
+slot_t slots[NSLOTS];
+
+
+/* Function returns monotonic time in nanoseconds */
+static inline unsigned long long now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/* Function returns random number from [a, b] range */
+static inline uint_t rnd(uint_t a, uint_t b)
+{
+	return a + (uint_t)(random() % (b - a + 1));
+}
+
+
+/* Function adds operation to trace */
+static int trace_add(trace_t *t, uint_t type, uint_t dest, uint_t slot, uint_t arg)
+{
+	op_t *ops;
+	
+	if (t->n == t->size) {
+		t->size = t->size ? 2 * t->size : 4096;
+		if ((ops = realloc(t->ops, t->size * sizeof(op_t))) == NULL)
+			return -1;
+		t->ops = ops;
+	}
+	
+	t->ops[t->n].type = type;
+	t->ops[t->n].dest = dest;
+	t->ops[t->n].slot = slot;
+	t->ops[t->n].arg = arg;
+	t->n++;
+	return 0;
+}
+
+
+/*
+ * Exec-like bursts - groups of processes are created and most of them
+ * exit in random order. Some survive the burst as long running tasks.
+ */
+static int gen_exec(trace_t *t, uint_t nops)
+{
+	uchar_t used[256];
+	uint_t k, s, burst;
+	
+	memset(used, 0, sizeof(used));
+	while (t->n < nops) {
+		burst = rnd(8, 32);
+		for (k = 0; k < burst; k++) {
+			s = rnd(0, 255);
+			if (!used[s]) {
+				trace_add(t, OP_EXEC, REG_MEM, s, rnd(8, 128));
+				used[s] = 1;
+			}
+		}
+		for (k = 0; k < 256; k++) {
+			if (used[k] && (rnd(0, 3) != 0)) {
+				trace_add(t, OP_EXIT, 0, k, 0);
+				used[k] = 0;
+			}
+		}
+	}
+	
+	for (k = 0; k < 256; k++)
+		if (used[k])
+			trace_add(t, OP_EXIT, 0, k, 0);
+	return 0;
+}
+
+
+/*
+ * Fragmentation churn - areas of mixed sizes are allocated and released
+ * in random order. Most of them are small, some are large. Regular areas
+ * may be scattered, kernel areas must be contiguous.
+ */
+static int gen_churn(trace_t *t, uint_t nops)
+{
+	uchar_t used[2048];
+	uint_t k, s, r, size;
+	
+	memset(used, 0, sizeof(used));
+	while (t->n < nops) {
+		s = rnd(0, 2047);
+		if (used[s]) {
+			trace_add(t, OP_FREE, 0, s, 0);
+			used[s] = 0;
+			continue;
+		}
+		
+		r = rnd(0, 99);
+		size = (r < 70) ? rnd(1, 4) : ((r < 95) ? rnd(5, 32) : rnd(33, 256));
+		trace_add(t, OP_ALLOC, (rnd(0, 4) ? REG_MEM : KERNEL_MEM), s, size);
+		used[s] = 1;
+	}
+	
+	for (k = 0; k < 2048; k++)
+		if (used[k])
+			trace_add(t, OP_FREE, 0, k, 0);
+	return 0;
+}
+
+
+/* DMA requests - contiguous DMA buffers mixed with kernel allocations */
+static int gen_dma(trace_t *t, uint_t nops)
+{
+	uchar_t used[512];
+	uint_t k, s;
+	
+	memset(used, 0, sizeof(used));
+	while (t->n < nops) {
+		s = rnd(0, 511);
+		if (used[s]) {
+			trace_add(t, OP_FREE, 0, s, 0);
+			used[s] = 0;
+		}
+		else if (rnd(0, 9) < 4) {
+			trace_add(t, OP_ALLOC, DMA_MEM, s, rnd(1, 16));
+			used[s] = 1;
+		}
+		else {
+			trace_add(t, OP_ALLOC, KERNEL_MEM, s, rnd(1, 64));
+			used[s] = 1;
+		}
+	}
+	
+	for (k = 0; k < 512; k++)
+		if (used[k])
+			trace_add(t, OP_FREE, 0, k, 0);
+	return 0;
+}
+
+
+/*
+ * kmalloc churn - small and large blocks. Live set grows and shrinks, so
+ * kmalloc areas are created and released.
+ */
+static int gen_kmalloc(trace_t *t, uint_t nops)
+{
+	static uchar_t used[NSLOTS];
+	uint_t k, s, r, live;
+	
+	memset(used, 0, sizeof(used));
+	while (t->n < nops) {
+		
+		/* Live set oscillates between 0 and NSLOTS / 2 */
+		live = (t->n / (NSLOTS / 2)) % 2 ? NSLOTS / 8 : NSLOTS / 2;
+		s = rnd(0, live - 1) + (rnd(0, 1) ? 0 : NSLOTS / 2 - live);
+		
+		if (used[s]) {
+			trace_add(t, OP_KFREE, 0, s, 0);
+			used[s] = 0;
+			continue;
+		}
+		
+		r = rnd(0, 99);
+		trace_add(t, OP_KMALLOC, 0, s, (r < 60) ? rnd(8, 256) : ((r < 95) ? rnd(257, 2040) : rnd(2041, 16384)));
+		used[s] = 1;
+	}
+	
+	for (k = 0; k < NSLOTS; k++)
+		if (used[k])
+			trace_add(t, OP_KFREE, 0, k, 0);
+	return 0;
+}
+
+
+/*
+ * Segment index - maps with hundreds of segments. Segments are mapped in
+ * random order, then looked up. Some of them are split and merged back.
+ */
+static int gen_segs(trace_t *t, uint_t nops)
+{
+	static uint_t order[NSEGS];
+	uint_t k, m, s, r, base = 0x100;
+	
+	for (m = 0; m < 4; m++) {
+		trace_add(t, OP_MAP, 0, m, 0);
+		
+		for (k = 0; k < NSEGS; k++)
+			order[k] = k;
+		for (k = NSEGS - 1; k > 0; k--) {
+			s = rnd(0, k);
+			r = order[k];
+			order[k] = order[s];
+			order[s] = r;
+		}
+		for (k = 0; k < NSEGS; k++)
+			trace_add(t, OP_SEG, rnd(2, 4), m, base + order[k] * 8);
+	}
+	
+	while (t->n < nops) {
+		m = rnd(0, 3);
+		s = base + rnd(0, NSEGS - 1) * 8;
+		
+		if (rnd(0, 9)) {
+			trace_add(t, OP_FIND, 0, m, s + rnd(0, 1));
+			continue;
+		}
+		trace_add(t, OP_SPLIT, 0, m, s + 1);
+		trace_add(t, OP_MERGE, 0, m, s);
+	}
+	
+	for (m = 0; m < 4; m++)
+		trace_add(t, OP_EXIT, 0, m, 0);
+	return 0;
+}
+
+
+/* Built-in trace generators */
+struct {
+	char *name;
+	int (*gen)(trace_t *, uint_t);
+} generators[] = {
+	{ "exec", gen_exec },
+	{ "churn", gen_churn },
+	{ "dma", gen_dma },
+	{ "kmalloc", gen_kmalloc },
+	{ "segs", gen_segs },
+	{ NULL, NULL }
+};
+
+
+/*
+ * Function reads trace from file. Every line contains single operation:
+ *   alloc <slot> <pages> dma|reg|kernel
+ *   free <slot>
+ *   kmalloc <slot> <bytes>
+ *   kfree <slot>
+ *   exec <slot> <pages>
+ *   exit <slot>
+ *   map <slot>
+ *   seg <slot> <page> <pages>
+ *   find|split|merge <slot> <page>
+ * Empty lines and lines beginning with # are ignored.
+ */
+static int trace_load(trace_t *t, char *path)
+{
+	FILE *f;
+	char line[128], op[16], dest[16];
+	uint_t k, d, slot, arg, lineno = 0;
+	int n;
+	
+	if ((f = fopen(path, "r")) == NULL) {
+		fprintf(stderr, "vmbench: can't open %s\n", path);
+		return -1;
+	}
+	
+	while (fgets(line, sizeof(line), f) != NULL) {
+		lineno++;
+		dest[0] = 0;
+		arg = 0;
+		if ((n = sscanf(line, "%15s %u %u %15s", op, &slot, &arg, dest)) <= 0 || op[0] == '#')
+			continue;
+		
+		for (k = 0; k < NOPS; k++)
+			if (!strcmp(op, op_names[k]))
+				break;
+		
+		for (d = 0; d < 3; d++)
+			if (!strcmp(dest, dest_names[d]))
+				break;
+		
+		if ((k == NOPS) || (n < 2) || (slot >= NSLOTS) ||
+		    (((k == OP_ALLOC) || (k == OP_KMALLOC) || (k == OP_EXEC) || (k >= OP_SEG)) && (n < 3)) ||
+		    ((k == OP_ALLOC) && (d == 3)) || ((k == OP_SEG) && ((n < 4) || (atoi(dest) < 1) || (atoi(dest) > 255)))) {
+			fprintf(stderr, "vmbench: %s:%u: bad operation\n", path, lineno);
+			fclose(f);
+			return -1;
+		}
+		
+		if (trace_add(t, k, (k == OP_ALLOC) ? d : ((k == OP_SEG) ? atoi(dest) : REG_MEM), slot, arg) < 0) {
+			fclose(f);
+			return -1;
+		}
+	}
+	
+	fclose(f);
+	return 0;
+}
+
+
+/* Function executes OP_EXEC - memory map with text, data and stack segments */
+static int do_exec(slot_t *s, uint_t npages)
+{
+	vm_map_t *map;
+	vm_seg_t *seg;
+	page_t *pages;
+	uint_t k, size[3];
+	void *vaddr[3];
+	
+	size[0] = npages / 2;
+	size[1] = npages / 4;
+	size[2] = npages - size[0] - size[1];
+	vaddr[0] = (void *)0x08048000;
+	vaddr[1] = (void *)0x10000000;
+	vaddr[2] = (void *)(0xc0000000UL - size[2] * PAGE_SIZE);
+	
+	if ((map = map_create()) == NULL)
+		return -1;
+	
+	for (k = 0; k < 3; k++) {
+		if (!size[k])
+			continue;
+		
+		if ((pages = area_alloc(size[k], REG_MEM)) == NULL) {
+			map_free(map);
+			return -1;
+		}
+		if ((seg = seg_create(pages, vaddr[k], size[k] * PAGE_SIZE, PGHD_USER | PGHD_WRITE)) == NULL) {
+			area_free(pages);
+			map_free(map);
+			return -1;
+		}
+		if (seg_map(map, seg) < 0) {
+			map_free(map);
+			return -1;
+		}
+	}
+	
+	if ((s->kstack = kernel_pages_alloc(1)) == NULL) {
+		map_free(map);
+		return -1;
+	}
+	
+	if ((s->task = kmalloc(TASK_SIZE)) == NULL) {
+		kernel_pages_free(s->kstack);
+		map_free(map);
+		return -1;
+	}
+	
+	s->obj = map;
+	return 0;
+}
+
+
+/* Function executes memory map operations of segs scenario */
+static int do_mapop(slot_t *s, op_t *op)
+{
+	vm_map_t *map = s->obj;
+	vm_seg_t *seg;
+	page_t *pages;
+	void *vaddr = (void *)((unsigned long)op->arg * PAGE_SIZE);
+	
+	if (op->type == OP_SEG) {
+		if ((pages = area_alloc(op->dest, REG_MEM)) == NULL)
+			return -1;
+		if ((seg = seg_create(pages, vaddr, op->dest * PAGE_SIZE, PGHD_USER | PGHD_WRITE)) == NULL) {
+			area_free(pages);
+			return -1;
+		}
+		return seg_map(map, seg);
+	}
+	
+	if ((seg = seg_find(map, vaddr)) == NULL)
+		return -1;
+	
+	switch (op->type) {
+	case OP_SPLIT:
+		return seg_split(map, seg, vaddr) == NULL ? -1 : 0;
+	case OP_MERGE:
+		return seg_merge(map, seg);
+	}
+	return 0;
+}
+
+
+/* Function releases object held by slot */
+static void slot_release(slot_t *s)
+{
+	switch (s->type) {
+	case OP_ALLOC:
+		area_free(s->obj);
+		break;
+	case OP_KMALLOC:
+		kfree(s->obj);
+		break;
+	case OP_EXEC:
+		kfree(s->task);
+		kernel_pages_free(s->kstack);
+		map_free(s->obj);
+		break;
+	case OP_MAP:
+		map_free(s->obj);
+		break;
+	}
+	s->obj = NULL;
+	return;
+}
+
+
+/* Function computes fragmentation of free memory */
+static void frag_get(frag_t *f)
+{
+	uint_t z, o;
+	page_t *p;
+	zone_t *zone;
+	
+	memset(f, 0, sizeof(frag_t));
+	for (z = 0; z < NZONES; z++) {
+		zone = &mem_map.zones[z];
+		f->free += zone->total_free;
+		
+		for (o = 0; o < MAX_ORDER; o++) {
+			if ((p = zone->free[o]) == NULL)
+				continue;
+			
+			do {
+				f->blocks++;
+				if (o < FRAG_ORDER)
+					f->unusable += 1 << o;
+				if (o > f->max_order)
+					f->max_order = o;
+				p = p->next;
+			} while (p != zone->free[o]);
+		}
+	}
+	return;
+}
+
+
+/* Comparison function for qsort() */
+static int cmp_lat(const void *a, const void *b)
+{
+	unsigned long long x = *(unsigned long long *)a, y = *(unsigned long long *)b;
+	
+	return (x > y) - (x < y);
+}
+
+
+/* Function returns p-th percentile of sorted latencies */
+static unsigned long long percentile(opstat_t *st, double p)
+{
+	uint_t k = (uint_t)(p * (st->n - 1) / 100.0 + 0.5);
+	
+	return st->lat[k];
+}
+
+
+/* Function replays trace and prints its statistics */
+static int trace_run(trace_t *t, int verbose)
+{
+	opstat_t stats[NOPS];
+	slot_t *s;
+	op_t *op;
+	frag_t f, worst;
+	unsigned long long t0, t1, total = 0;
+	uint_t k, free_before, kmalloc_before, skipped = 0;
+	int err;
+	
+	memset(stats, 0, sizeof(stats));
+	for (k = 0; k < NOPS; k++)
+		if ((stats[k].lat = malloc(t->n * sizeof(unsigned long long))) == NULL)
+			return -1;
+	
+	memset(slots, 0, sizeof(slots));
+	memset(&worst, 0, sizeof(worst));
+	
+	frag_get(&f);
+	free_before = f.free;
+	kmalloc_before = kmalloc_getpages();
+	
+	for (k = 0; k < t->n; k++) {
+		op = &t->ops[k];
+		s = &slots[op->slot];
+		
+		/*
+		 * Allocation into busy slot, release of empty one and map operation
+		 * on slot without memory map are skipped
+		 */
+		if ((IS_ALLOCOP(op->type) && s->obj) || (IS_RELEASEOP(op->type) && !s->obj) ||
+		    (!IS_ALLOCOP(op->type) && !IS_RELEASEOP(op->type) && (!s->obj || (s->type != OP_MAP)))) {
+			skipped++;
+			continue;
+		}
+		
+		err = 0;
+		t0 = now();
+		switch (op->type) {
+		case OP_ALLOC:
+			err = (s->obj = area_alloc(op->arg, op->dest)) == NULL;
+			break;
+		case OP_KMALLOC:
+			err = (s->obj = kmalloc(op->arg)) == NULL;
+			break;
+		case OP_EXEC:
+			err = do_exec(s, op->arg) < 0;
+			break;
+		case OP_MAP:
+			err = (s->obj = map_create()) == NULL;
+			break;
+		case OP_SEG:
+		case OP_FIND:
+		case OP_SPLIT:
+		case OP_MERGE:
+			err = do_mapop(s, op) < 0;
+			break;
+		default:
+			slot_release(s);
+			break;
+		}
+		t1 = now();
+		if (IS_ALLOCOP(op->type))
+			s->type = op->type;
+		
+		stats[op->type].lat[stats[op->type].n++] = t1 - t0;
+		stats[op->type].total += t1 - t0;
+		stats[op->type].failed += err;
+		total += t1 - t0;
+		
+		if (k % SAMPLE_OPS == 0) {
+			frag_get(&f);
+			if (f.free && (!worst.free || (f.unusable * 100 / f.free > worst.unusable * 100 / worst.free)))
+				worst = f;
+		}
+	}
+	
+	/* Objects left by trace are released outside of measurement */
+	for (k = 0; k < NSLOTS; k++)
+		if (slots[k].obj != NULL)
+			slot_release(&slots[k]);
+	
+	/* Buckets cached in kmalloc magazines are returned, as on memory pressure */
+	kmalloc_reclaim();
+	
+	printf("\n[%s] %u operations, %u skipped, %.3f ms, %.0f ops/s\n", t->name, t->n - skipped, skipped,
+	       total / 1e6, total ? (t->n - skipped) * 1e9 / total : 0.0);
+	printf("  %-8s %9s %7s %12s %8s %8s %8s %9s\n", "op", "count", "failed", "ops/s", "p50[ns]", "p99[ns]", "p99.9[ns]", "max[ns]");
+	
+	for (k = 0; k < NOPS; k++) {
+		if (!stats[k].n)
+			continue;
+		qsort(stats[k].lat, stats[k].n, sizeof(unsigned long long), cmp_lat);
+		printf("  %-8s %9u %7u %12.0f %8llu %8llu %8llu %9llu\n", op_names[k], stats[k].n, stats[k].failed,
+		       stats[k].total ? stats[k].n * 1e9 / stats[k].total : 0.0,
+		       percentile(&stats[k], 50), percentile(&stats[k], 99), percentile(&stats[k], 99.9),
+		       stats[k].lat[stats[k].n - 1]);
+	}
+	
+	if (worst.free)
+		printf("  worst fragmentation: %u free pages in %u blocks, largest order %u, %u%% unusable for order %u\n",
+		       worst.free, worst.blocks, worst.max_order, worst.unusable * 100 / worst.free, FRAG_ORDER);
+	
+	/* Pages kept by kmalloc areas aren't lost, other missing pages are */
+	frag_get(&f);
+	printf("  after release: %u free pages in %u blocks, largest order %u, kmalloc %u pages (%+d)\n",
+	       f.free, f.blocks, f.max_order, kmalloc_getpages(), (int)(kmalloc_getpages() - kmalloc_before));
+	
+	if (verbose)
+		printf("  pmap: %u pmaps, %u page tables, %u mapped pages\n", pmap_stats.pmaps, pmap_stats.ptables, pmap_stats.mapped);
+	
+	if (free_before + kmalloc_before != f.free + kmalloc_getpages())
+		printf("  LEAK: %d pages\n", (int)(free_before + kmalloc_before) - (int)(f.free + kmalloc_getpages()));
+	
+	for (k = 0; k < NOPS; k++)
+		free(stats[k].lat);
+	return 0;
+}
+
+
+/* Bucket sizes of kmalloc size classes and number of objects allocated in one batch by kmscale */
+static uint_t kmscale_sizes[] = { 32, 64, 128, 252, 508, 1020, 2040 };
+#define KMSCALE_NCLASSES  (sizeof(kmscale_sizes) / sizeof(kmscale_sizes[0]))
+#define KMSCALE_BATCH     256
+
+
+/*
+ * kmalloc scalability - every size class is grown by n areas and every other
+ * bucket is released, so all areas are partially used. Then batches larger
+ * than magazines are allocated and released, so buckets are taken from areas
+ * and returned to them. Latency per operation shouldn't depend on n.
+ */
+static int bench_kmscale(uint_t nops)
+{
+	static uint_t ns[] = { 1, 4, 16, 64, 256 };
+	void **held = NULL, **p, *batch[KMSCALE_BATCH];
+	uint_t k, i, j, c, size, nheld, maxheld = 0, before, rounds;
+	unsigned long long t0, talloc, tfree;
+	
+	printf("\n[kmscale] kmalloc/kfree latency with n partially used areas per size class\n");
+	printf("  %6s %10s %14s %12s\n", "n", "kmalloc pg", "kmalloc[ns]", "kfree[ns]");
+	
+	rounds = nops / (2 * KMSCALE_BATCH) + 1;
+	for (k = 0; k < sizeof(ns) / sizeof(ns[0]); k++) {
+		
+		/* Grow every size class by ns[k] areas */
+		nheld = 0;
+		for (c = 0; c < KMSCALE_NCLASSES; c++) {
+			before = kmalloc_getpages();
+			while (kmalloc_getpages() - before < ns[k] * 2) {
+				if (nheld == maxheld) {
+					maxheld = maxheld ? 2 * maxheld : 4096;
+					if ((p = realloc(held, maxheld * sizeof(void *))) == NULL)
+						return -1;
+					held = p;
+				}
+				if ((held[nheld] = kmalloc(kmscale_sizes[c])) == NULL)
+					return -1;
+				nheld++;
+			}
+		}
+		
+		/* Every other bucket is released, magazines are drained */
+		for (i = 0; i < nheld; i += 2)
+			kfree(held[i]);
+		kmalloc_reclaim();
+		
+		talloc = tfree = 0;
+		for (i = 0; i < rounds; i++) {
+			size = kmscale_sizes[rnd(0, KMSCALE_NCLASSES - 1)];
+			
+			t0 = now();
+			for (j = 0; j < KMSCALE_BATCH; j++)
+				batch[j] = kmalloc(size);
+			talloc += now() - t0;
+			
+			t0 = now();
+			for (j = 0; j < KMSCALE_BATCH; j++)
+				kfree(batch[j]);
+			tfree += now() - t0;
+		}
+		
+		printf("  %6u %10u %14.1f %12.1f\n", ns[k], kmalloc_getpages(),
+		       (double)talloc / (rounds * KMSCALE_BATCH), (double)tfree / (rounds * KMSCALE_BATCH));
+		
+		for (i = 1; i < nheld; i += 2)
+			kfree(held[i]);
+		kmalloc_reclaim();
+	}
+	
+	free(held);
+	return 0;
+}
+
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: vmbench [-v] [-H] [-m memory_mb] [-n ops] [-s seed] [-t trace_file] [exec|churn|dma|kmalloc|segs|kmscale] ...\n");
+	return;
+}
+
+
+int main(int argc, char *argv[])
+{
+	uint_t memsize = 128, nops = 200000, seed = 1;
+	char *tracefile = NULL;
+	int c, k, i, verbose = 0, hole = 0;
+	unsigned long long t0;
+	trace_t t;
+	
+	while ((c = getopt(argc, argv, "m:n:s:t:vHh")) >= 0) {
+		switch (c) {
+		case 'm':
+			memsize = atoi(optarg);
+			break;
+		case 'n':
+			nops = atoi(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		case 't':
+			tracefile = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'H':
+			hole = 1;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+	
+	if ((memsize < 32) || (memsize > 1024)) {
+		fprintf(stderr, "vmbench: memory size must be between 32 and 1024 MB\n");
+		return -1;
+	}
+	
+	if (sim_init(memsize << 20, hole) < 0) {
+		fprintf(stderr, "vmbench: can't allocate simulated memory\n");
+		return -1;
+	}
+	
+	t0 = now();
+	init_mem_map(memsize << 20);
+	t0 = now() - t0;
+	
+	if ((kmalloc_init(2) < 0) || (vm_init() < 0)) {
+		fprintf(stderr, "vmbench: can't initialize allocators\n");
+		return -1;
+	}
+	
+	printf("vmbench: %u MB of simulated memory%s, seed %u\n", memsize, hole ? " with ISA hole" : "", seed);
+	printf("init_mem_map: %.3f ms\n", t0 / 1e6);
+	disp_meminfo();
+	
+	if (tracefile != NULL) {
+		memset(&t, 0, sizeof(t));
+		t.name = tracefile;
+		if (trace_load(&t, tracefile) < 0)
+			return -1;
+		trace_run(&t, verbose);
+		free(t.ops);
+		return 0;
+	}
+	
+	for (k = 0; generators[k].name != NULL; k++) {
+		
+		/* Without arguments all scenarios are run */
+		for (i = optind; i < argc; i++)
+			if (!strcmp(argv[i], generators[k].name))
+				break;
+		if ((optind < argc) && (i == argc))
+			continue;
+		
+		srandom(seed);
+		memset(&t, 0, sizeof(t));
+		t.name = generators[k].name;
+		if (generators[k].gen(&t, nops) < 0) {
+			fprintf(stderr, "vmbench: out of memory\n");
+			return -1;
+		}
+		trace_run(&t, verbose);
+		free(t.ops);
+	}
+	
+	/* kmalloc scalability isn't trace based, it's run after traces */
+	for (i = optind; i < argc; i++)
+		if (!strcmp(argv[i], "kmscale"))
+			break;
+	if ((optind == argc) || (i < argc)) {
+		srandom(seed);
+		if (bench_kmscale(nops) < 0) {
+			fprintf(stderr, "vmbench: out of memory\n");
+			return -1;
+		}
+	}
+	
+	for (i = optind; i < argc; i++) {
+		for (k = 0; generators[k].name != NULL; k++)
+			if (!strcmp(argv[i], generators[k].name))
+				break;
+		if ((generators[k].name == NULL) && strcmp(argv[i], "kmscale"))
+			fprintf(stderr, "vmbench: unknown scenario %s\n", argv[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * Phoenix-RTOS
+ *
+ * vmbench - host benchmark of kernel memory allocators
+ *
+ * Common definitions
+ *
+ * Copyright 2001 Pawel Pisarczyk
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * Phoenix-RTOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Phoenix-RTOS kernel is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Phoenix-RTOS kernel; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _VMBENCH_H_
+#define _VMBENCH_H_
+
+#include <hal/current/types.h>
+
+
+/* Bookkeeping of the simulated pmap interface */
+typedef struct _pmap_stats_t {
+	uint_t pmaps;        /* number of existing pmaps */
+	uint_t ptables;      /* number of allocated page tables */
+	uint_t mapped;       /* number of mapped pages */
+} pmap_stats_t;
+
+
+extern pmap_stats_t pmap_stats;
+
+
+/*
+ * Function allocates simulated physical memory of given size. When hole is
+ * set, memory between 15 and 16 MB is reserved like ISA hole in BIOS map.
+ */
+extern int sim_init(uint_t size, int hole);
+
+
+#endif